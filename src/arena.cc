@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "trace.h"
+
+static const Vector2i directions[] = {
+	{+0, -1}, // UP
+	{-1, +0}, // LEFT
+	{+0, +1}, // DOWN
+	{+1, +0}, // RIGHT
+};
+
+void make_arena(Arena * a, int width, int height)
+{
+	if (width > ARENA_MAX_SIZE) width = ARENA_MAX_SIZE;
+	if (height > ARENA_MAX_SIZE) height = ARENA_MAX_SIZE;
+	a->width = width;
+	a->height = height;
+	a->chunks_x = (width + ARENA_CHUNK - 1) / ARENA_CHUNK;
+	a->chunks_y = (height + ARENA_CHUNK - 1) / ARENA_CHUNK;
+	a->chunks = (ArenaChunk*) calloc((size_t) a->chunks_x * a->chunks_y, sizeof(ArenaChunk));
+}
+
+void destroy_arena(Arena * a)
+{
+	free(a->chunks);
+	a->chunks = NULL;
+}
+
+void generate_arena(Arena * a, Rng * rng, int loop_percent)
+{
+	TRACE_SCOPE("generate_arena");
+	memset(a->chunks, 0, sizeof(ArenaChunk) * a->chunks_x * a->chunks_y);
+	// Corridor cells are (2i + 1, 2j + 1); the walls between them are
+	// what gets carved
+	int maze_w = (a->width - 1) / 2;
+	int maze_h = (a->height - 1) / 2;
+	if (maze_w <= 0 || maze_h <= 0) return;
+
+	// Explicit stack, since the recursion would be millions deep on
+	// the biggest arenas. Holds corridor cell coordinates.
+	List<Vector2i> stack;
+	stack.alloc();
+	Vector2i start = Vector2i(rng_range(rng, maze_w), rng_range(rng, maze_h));
+	arena_set_open(a, start.x * 2 + 1, start.y * 2 + 1, true);
+	stack.push(start);
+	while (stack.len > 0) {
+		Vector2i c = stack[stack.len - 1];
+		int options[4];
+		int option_count = 0;
+		for (int i = 0; i < 4; i++) {
+			Vector2i n = c + directions[i];
+			if (n.x < 0 || n.x >= maze_w || n.y < 0 || n.y >= maze_h) continue;
+			if (arena_open(a, n.x * 2 + 1, n.y * 2 + 1)) continue;
+			options[option_count++] = i;
+		}
+		if (option_count == 0) {
+			stack.pop();
+			continue;
+		}
+		Vector2i d = directions[options[rng_range(rng, option_count)]];
+		Vector2i n = c + d;
+		arena_set_open(a, c.x * 2 + 1 + d.x, c.y * 2 + 1 + d.y, true);
+		arena_set_open(a, n.x * 2 + 1, n.y * 2 + 1, true);
+		stack.push(n);
+	}
+	stack.dealloc();
+
+	// A wall between two corridors is one with open cells on both
+	// sides along one axis
+	for (int y = 1; y < maze_h * 2; y++) {
+		for (int x = 1 + (y & 1); x < maze_w * 2; x += 2) {
+			if (arena_open(a, x, y)) continue;
+			bool between =
+				(arena_open(a, x - 1, y) && arena_open(a, x + 1, y)) ||
+				(arena_open(a, x, y - 1) && arena_open(a, x, y + 1));
+			if (between && rng_range(rng, 100) < loop_percent) {
+				arena_set_open(a, x, y, true);
+			}
+		}
+	}
+}
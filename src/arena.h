@@ -0,0 +1,68 @@
+#ifndef NES_ARENA_H
+#define NES_ARENA_H
+
+// Runtime-sized maps, up to 4096x4096, for stress-testing ghost AI
+// far past the game's board. The game itself keeps the fixed 16x13
+// Level: Sim gets copied around by value, and the renderer, replays
+// and observations are all laid out for that size.
+//
+// Storage is chunked. The map is cut into 16x16 chunks and each chunk
+// is 16 uint16_t rows of open bits, the same layout as
+// Level::open_rows. A chunk is 32 contiguous bytes, so work on one
+// neighbourhood (like a cluster search in hpa.h) stays inside a single
+// cache line rather than striding across the whole map. Cells past the
+// right or bottom edge are walls.
+
+#include <stdint.h>
+#include <utility.h>
+
+#include "sim.h"
+
+#define ARENA_CHUNK    16
+#define ARENA_MAX_SIZE 4096
+
+struct ArenaChunk {
+	uint16_t rows[ARENA_CHUNK];
+};
+
+struct Arena {
+	int width, height;
+	int chunks_x, chunks_y;
+	ArenaChunk * chunks; // row-major, chunks_x * chunks_y
+};
+
+// Starts out solid wall
+void make_arena(Arena * a, int width, int height);
+void destroy_arena(Arena * a);
+
+inline const ArenaChunk * arena_chunk(const Arena * a, int cx, int cy)
+{
+	return a->chunks + cx + cy * a->chunks_x;
+}
+
+inline bool arena_open(const Arena * a, int x, int y)
+{
+	if (x < 0 || x >= a->width || y < 0 || y >= a->height) return false;
+	const ArenaChunk * c = arena_chunk(a, x / ARENA_CHUNK, y / ARENA_CHUNK);
+	return (c->rows[y % ARENA_CHUNK] >> (x % ARENA_CHUNK)) & 1;
+}
+
+inline void arena_set_open(Arena * a, int x, int y, bool open)
+{
+	ArenaChunk * c = a->chunks + x / ARENA_CHUNK + (y / ARENA_CHUNK) * a->chunks_x;
+	uint16_t bit = (uint16_t) (1u << (x % ARENA_CHUNK));
+	if (open) {
+		c->rows[y % ARENA_CHUNK] |= bit;
+	} else {
+		c->rows[y % ARENA_CHUNK] &= ~bit;
+	}
+}
+
+// Carves a maze with corridors on the odd cells (randomised
+// depth-first, so it's linear in the arena size), then knocks out
+// loop_percent of the walls left between two corridors. A perfect
+// maze has exactly one route between any two cells; the loops give
+// ghosts real choices to make.
+void generate_arena(Arena * a, Rng * rng, int loop_percent = 10);
+
+#endif
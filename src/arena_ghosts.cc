@@ -0,0 +1,44 @@
+#include <stdlib.h>
+
+#include "arena_ghosts.h"
+#include "trace.h"
+
+void make_arena_ghosts(ArenaGhosts * g, const Arena * a, const Hpa * h, Rng * rng, int count)
+{
+	g->count = count;
+	g->pos = (Vector2i*) malloc(sizeof(Vector2i) * (count ? count : 1));
+	for (int i = 0; i < count; i++) {
+		Vector2i p;
+		do {
+			p.x = rng_range(rng, a->width);
+			p.y = rng_range(rng, a->height);
+		} while (!arena_open(a, p.x, p.y));
+		g->pos[i] = p;
+	}
+	make_hpa_scratch(&g->scratch, h);
+	// Room for a couple of routes per cluster, and for every ghost's
+	// own path until it joins someone else's
+	make_hpa_cache(&g->cache, 2 * h->clusters_x * h->clusters_y + 64 * count);
+}
+
+void destroy_arena_ghosts(ArenaGhosts * g)
+{
+	destroy_hpa_cache(&g->cache);
+	destroy_hpa_scratch(&g->scratch);
+	free(g->pos);
+	g->pos = NULL;
+	g->count = 0;
+}
+
+int step_arena_ghosts(ArenaGhosts * g, const Arena * a, const Hpa * h, Vector2i target)
+{
+	TRACE_SCOPE("step_arena_ghosts");
+	int arrived = 0;
+	for (int i = 0; i < g->count; i++) {
+		Vector2i step;
+		int len = hpa_first_step_cached(h, a, &g->scratch, &g->cache, g->pos[i], target, &step);
+		if (len > 0) g->pos[i] = g->pos[i] + step;
+		if (g->pos[i].x == target.x && g->pos[i].y == target.y) arrived++;
+	}
+	return arrived;
+}
@@ -0,0 +1,34 @@
+#ifndef NES_ARENA_GHOSTS_H
+#define NES_ARENA_GHOSTS_H
+
+// Headless ghost AI on an Arena: a crowd of ghosts chasing one target
+// across the map through the Hpa, a cell per step. No rendering,
+// timers or power levels -- just the routing, which is what the big
+// maps are there to stress.
+//
+// All the ghosts share one HpaCache. The first ghost to cross a
+// region pays for a search and the rest follow its route for a few
+// 16x16 floods a step.
+
+#include <utility.h>
+
+#include "arena.h"
+#include "hpa.h"
+
+struct ArenaGhosts {
+	int count;
+	Vector2i * pos;
+	HpaScratch scratch;
+	HpaCache cache;
+};
+
+// count ghosts on random open cells. Made for one layout: remake them
+// after build_hpa runs again.
+void make_arena_ghosts(ArenaGhosts * g, const Arena * a, const Hpa * h, Rng * rng, int count);
+void destroy_arena_ghosts(ArenaGhosts * g);
+
+// Moves every ghost one cell toward target. Ghosts that can't reach it
+// stay put. Returns how many are standing on it afterwards.
+int step_arena_ghosts(ArenaGhosts * g, const Arena * a, const Hpa * h, Vector2i target);
+
+#endif
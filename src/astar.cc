@@ -1,99 +1,137 @@
 #include "astar.h"
+#include "trace.h"
 
-#define SQR(a) (a) * (a)
-
-Vector2i dirs[4] = {
+static const Vector2i dirs[4] = {
 	{-1, +0}, // left
 	{+1, +0}, // right
 	{+0, -1}, // up
 	{+0, +1}, // down
 };
 
-struct Vert {
-	Vector2i pos;
-	float dist;
-	float heur;
-	int viewed_index;
-};
+static const VertCompare vert_compare = VertCompare();
+static const VertKey vert_key = VertKey();
 
-bool vert_compare(Vert a, Vert b)
+void make_path_scratch(PathScratch * s, int max_width, int max_height)
 {
-	return (a.dist + a.heur) < (b.dist + b.heur);
+	int cells = max_width * max_height;
+	s->capacity  = cells;
+	s->closed    = (uint32_t*) malloc(sizeof(uint32_t) * ((cells + 31) / 32));
+	s->came_from = (int*) malloc(sizeof(int) * cells);
+	s->g_score   = (int*) malloc(sizeof(int) * cells);
+	iheap_alloc(&s->open, cells);
 }
 
-bool vert_equality(Vert a, Vert b)
+void destroy_path_scratch(PathScratch * s)
 {
-	return a.pos.x == b.pos.x && a.pos.y == b.pos.y;
+	iheap_dealloc(&s->open);
+	free(s->g_score);
+	free(s->came_from);
+	free(s->closed);
 }
 
-#define DEBUG_MODE 0
-List<Vector2i> a_star(
-	const int * map, int width, int height,
+// Returns the path length to dest, leaving came_from filled in, or -1
+static int search(
+	PathScratch * s, const int * map, int width, int height,
 	Vector2i start, Vector2i dest)
 {
-	float * heu_map = (float*) malloc(sizeof(float) * width * height);
-	if (DEBUG_MODE) printf("Heuristic map:\n");
-	for (int y = 0; y < height; y++) {
-		for (int x = 0; x < width; x++) {
-			heu_map[x+y*width] = sqrt(SQR(y - dest.y) + SQR(x - dest.x));
-			if (DEBUG_MODE) printf("%.2f ", heu_map[x+y*width]);
-		}
-		if (DEBUG_MODE) printf("\n");
-	}
-	
-	List<Vector2i> directions;
-	directions.alloc();
+	int cells = width * height;
+	memset(s->closed, 0, sizeof(uint32_t) * ((cells + 31) / 32));
+	iheap_clear(&s->open, vert_key);
+	uint32_t * closed = s->closed;
+	int * came_from = s->came_from;
+	int * g_score = s->g_score;
 
-	List<Vert> heap;
-	heap.alloc();
-	List<Vert> viewed;
-	viewed.alloc();
-	Vert start_v;
-	start_v.pos  = start;
-	start_v.dist = 0;
-	start_v.heur = heu_map[start.x+start.y*width];
-	start_v.viewed_index = -1;
-	heap_insert(&heap, start_v, vert_compare);
-	while (heap.len > 0) {
-		auto check = [map, width, height](Vector2i t) {
-			if (t.x < 0 || t.x >= width  ||
-				t.y < 0 || t.y >= height ||
-				map[t.x+t.y*width]) {
-				return false;
-			}
-			return true;
-		};
-		Vert v = heap_pop(&heap, vert_compare);
-		if (v.pos.x == dest.x && v.pos.y == dest.y) {
-			if (viewed.len == 0) break;
-			Vert e = v;
-			Vert b = viewed[v.viewed_index];
-			do {
-				directions.push(Vector2i(e.pos.x - b.pos.x, e.pos.y - b.pos.y));
-				Vert temp = b;
-				b = viewed[b.viewed_index];
-				e = temp;
-			} while (e.viewed_index != -1);
-			break;
+	// Manhattan distance never overestimates on a 4-connected grid and
+	// changes by at most 1 per step, so the first time dest is popped its
+	// g is the true shortest distance.
+	auto heuristic = [dest](int x, int y) {
+		return abs(x - dest.x) + abs(y - dest.y);
+	};
+
+	PathVert start_v;
+	start_v.index = start.x + start.y * width;
+	start_v.g = 0;
+	start_v.f = heuristic(start.x, start.y);
+	g_score[start_v.index] = 0;
+	came_from[start_v.index] = -1;
+	iheap_insert(&s->open, start_v, vert_compare, vert_key);
+
+	int dest_index = dest.x + dest.y * width;
+	while (s->open.len > 0) {
+		PathVert v = iheap_pop(&s->open, vert_compare, vert_key);
+		if (v.index == dest_index) {
+			return v.g;
 		}
+		closed[v.index >> 5] |= 1u << (v.index & 31);
+		int vx = v.index % width;
+		int vy = v.index / width;
 		for (int i = 0; i < 4; i++) {
-			Vert nv;
-			nv.pos  = v.pos + dirs[i];
-			nv.dist = sqrt(SQR(nv.pos.y - dest.y) + SQR(nv.pos.x - dest.x));
-			nv.heur = heu_map[nv.pos.x+nv.pos.y*width];
-			nv.viewed_index = viewed.len;
-			if (check(nv.pos) &&
-				heap  .find(nv, vert_equality) == -1 &&
-				viewed.find(nv, vert_equality) == -1) {
-				if (DEBUG_MODE) printf("%d %d\n", nv.pos.x, nv.pos.y);
-				heap_insert(&heap, nv, vert_compare);
+			int nx = vx + dirs[i].x;
+			int ny = vy + dirs[i].y;
+			if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+			int ni = nx + ny * width;
+			if (map[ni]) continue;
+			if (closed[ni >> 5] & (1u << (ni & 31))) continue;
+			PathVert nv;
+			nv.index = ni;
+			nv.g = v.g + 1;
+			nv.f = nv.g + heuristic(nx, ny);
+			if (!iheap_contains(&s->open, ni)) {
+				g_score[ni] = nv.g;
+				came_from[ni] = v.index;
+				iheap_insert(&s->open, nv, vert_compare, vert_key);
+			} else if (nv.g < g_score[ni]) {
+				g_score[ni] = nv.g;
+				came_from[ni] = v.index;
+				iheap_decrease(&s->open, nv, vert_compare, vert_key);
 			}
 		}
-		viewed.push(v);
 	}
-	heap.dealloc();
-	viewed.dealloc();
-	free(heu_map);
-	directions.reverse();
+	return -1;
+}
+
+int a_star_path(
+	PathScratch * s, const int * map, int width, int height,
+	Vector2i start, Vector2i dest, Vector2i * path, int max_len)
+{
+	if (start.x == dest.x && start.y == dest.y) return 0;
+	TRACE_SCOPE("a_star");
+	int len = search(s, map, width, height, start, dest);
+	if (len < 0) return -1;
+	// Walk back from dest, only keeping the steps that fit
+	int k = len - 1;
+	for (int i = dest.x + dest.y * width; s->came_from[i] != -1; i = s->came_from[i], k--) {
+		if (k >= max_len) continue;
+		int p = s->came_from[i];
+		path[k] = Vector2i(i % width - p % width, i / width - p / width);
+	}
+	return len;
+}
+
+bool a_star_first_step(
+	PathScratch * s, const int * map, int width, int height,
+	Vector2i start, Vector2i dest, Vector2i * step)
+{
+	return a_star_path(s, map, width, height, start, dest, step, 1) > 0;
+}
+
+List<Vector2i> a_star(
+	const int * map, int width, int height,
+	Vector2i start, Vector2i dest)
+{
+	List<Vector2i> directions;
+	directions.alloc();
+	PathScratch s;
+	make_path_scratch(&s, width, height);
+	int len = a_star_path(&s, map, width, height, start, dest, NULL, 0);
+	if (len > 0) {
+		int dest_index = dest.x + dest.y * width;
+		for (int i = dest_index; s.came_from[i] != -1; i = s.came_from[i]) {
+			int p = s.came_from[i];
+			directions.push(Vector2i(i % width - p % width, i / width - p / width));
+		}
+		directions.reverse();
+	}
+	destroy_path_scratch(&s);
 	return directions;
 }
@@ -2,9 +2,59 @@
 #define NES_ASTAR_H
 
 #include <math.h>
+#include <stdint.h>
 #include <utility.h>
 #include "heap.h"
 
+// g is the number of steps from start, f = g + manhattan distance to
+// dest.
+struct PathVert {
+	int index;
+	int g;
+	int f;
+};
+
+struct VertCompare {
+	bool operator()(const PathVert & a, const PathVert & b) const
+	{
+		// Break ties toward the vertex closer to dest
+		return a.f < b.f || (a.f == b.f && a.g > b.g);
+	}
+};
+
+struct VertKey {
+	int operator()(const PathVert & v) const
+	{
+		return v.index;
+	}
+};
+
+// Everything a search needs, sized once for the largest grid it'll
+// be used on. Searches through a scratch never touch the allocator.
+struct PathScratch {
+	int capacity;
+	uint32_t * closed;
+	int * came_from;
+	int * g_score;
+	IndexedHeap<PathVert, 4> open;
+};
+
+void make_path_scratch(PathScratch * s, int max_width, int max_height);
+void destroy_path_scratch(PathScratch * s);
+
+// Writes the first (up to) max_len steps of a shortest path into
+// path. Returns the full path length, 0 if start == dest, or -1 if
+// dest can't be reached.
+int a_star_path(
+	PathScratch * s, const int * cmap, int width, int height,
+	Vector2i start, Vector2i dest, Vector2i * path, int max_len);
+
+// Same search, but only reports the first step
+bool a_star_first_step(
+	PathScratch * s, const int * cmap, int width, int height,
+	Vector2i start, Vector2i dest, Vector2i * step);
+
+// Allocating convenience wrapper. Caller deallocs the list.
 List<Vector2i> a_star(
 	const int * cmap, int width, int height,
 	Vector2i start, Vector2i dest);
@@ -0,0 +1,56 @@
+#include <chrono>
+#include <string.h>
+
+#include "audio.h"
+
+void make_sound_queue(SoundQueue * q)
+{
+	q->head = 0;
+	q->tail = 0;
+	q->dropped = 0;
+}
+
+void make_audio_sink(AudioSink * sink, PlaySoundFunc play, void * user)
+{
+	sink->play = play;
+	sink->user = user;
+	memset(sink->counts, 0, sizeof(sink->counts));
+	sink->handled = 0;
+}
+
+int audio_drain(SoundQueue * q, AudioSink * sink)
+{
+	int n = 0;
+	SoundEvent e;
+	while (sound_queue_pop(q, &e)) {
+		if (e < SOUND_EVENT_COUNT) sink->counts[e]++;
+		if (sink->play) sink->play(sink->user, e);
+		sink->handled.fetch_add(1, std::memory_order_release);
+		n++;
+	}
+	return n;
+}
+
+static void audio_thread_loop(AudioThread * t)
+{
+	while (t->running.load(std::memory_order_acquire)) {
+		if (audio_drain(t->queue, t->sink) == 0) {
+			std::this_thread::sleep_for(std::chrono::microseconds(AUDIO_THREAD_PERIOD_US));
+		}
+	}
+	audio_drain(t->queue, t->sink);
+}
+
+void start_audio_thread(AudioThread * t, SoundQueue * q, AudioSink * sink)
+{
+	t->queue = q;
+	t->sink = sink;
+	t->running = true;
+	t->thread = std::thread(audio_thread_loop, t);
+}
+
+void stop_audio_thread(AudioThread * t)
+{
+	t->running.store(false, std::memory_order_release);
+	if (t->thread.joinable()) t->thread.join();
+}
@@ -0,0 +1,95 @@
+#ifndef NES_AUDIO_H
+#define NES_AUDIO_H
+
+// Sound events on their way out of the simulation. A sim pushes onto
+// its SoundQueue (see Sim::sounds) and never waits on anything; an
+// AudioSink on the other end pops them off and plays them, or, with
+// no play function, just counts them, so headless and batch runs need
+// no audio device at all.
+//
+// The queue is single-producer single-consumer and lock-free: the
+// producer only writes tail, the consumer only writes head, each on
+// its own cache line. If the consumer falls a whole queue behind,
+// new events are dropped (and counted) rather than blocking the sim.
+
+#include <atomic>
+#include <stdint.h>
+#include <thread>
+
+#include "sim.h"
+
+// Power of two, so positions wrap with a mask
+#define SOUND_QUEUE_SIZE 256
+
+struct SoundQueue {
+	std::atomic<uint32_t> head; // next to pop
+	char pad0[64 - sizeof(std::atomic<uint32_t>)];
+	std::atomic<uint32_t> tail; // next to push
+	uint32_t dropped;           // producer side too
+	char pad1[64 - sizeof(std::atomic<uint32_t>) - sizeof(uint32_t)];
+	uint8_t events[SOUND_QUEUE_SIZE]; // SoundEvent
+};
+
+void make_sound_queue(SoundQueue * q);
+
+// Producer side. Returns false (and counts a drop) if the queue is full.
+inline bool sound_queue_push(SoundQueue * q, SoundEvent e)
+{
+	uint32_t tail = q->tail.load(std::memory_order_relaxed);
+	if (tail - q->head.load(std::memory_order_acquire) == SOUND_QUEUE_SIZE) {
+		q->dropped++;
+		return false;
+	}
+	q->events[tail & (SOUND_QUEUE_SIZE - 1)] = (uint8_t) e;
+	q->tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+// Consumer side. Returns false if there's nothing queued.
+inline bool sound_queue_pop(SoundQueue * q, SoundEvent * e)
+{
+	uint32_t head = q->head.load(std::memory_order_relaxed);
+	if (head == q->tail.load(std::memory_order_acquire)) return false;
+	*e = (SoundEvent) q->events[head & (SOUND_QUEUE_SIZE - 1)];
+	q->head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+typedef void (*PlaySoundFunc)(void * user, SoundEvent e);
+
+struct AudioSink {
+	// NULL makes this the null sink, which only counts
+	PlaySoundFunc play;
+	void * user;
+	uint64_t counts[SOUND_EVENT_COUNT];
+	// Events handled so far, for the producer side to tell when
+	// everything it pushed has been played
+	std::atomic<uint32_t> handled;
+};
+
+void make_audio_sink(AudioSink * sink, PlaySoundFunc play = NULL, void * user = NULL);
+// Pops everything queued into sink and returns how many there were
+int audio_drain(SoundQueue * q, AudioSink * sink);
+// Whether the sink has handled everything pushed onto q so far.
+// Producer side.
+inline bool audio_caught_up(const SoundQueue * q, const AudioSink * sink)
+{
+	return sink->handled.load(std::memory_order_acquire) ==
+		q->tail.load(std::memory_order_relaxed);
+}
+
+// Drains a queue into a sink from its own thread, so the thread
+// stepping the sim never calls into the mixer
+#define AUDIO_THREAD_PERIOD_US 1000
+struct AudioThread {
+	SoundQueue * queue;
+	AudioSink * sink;
+	std::atomic<bool> running;
+	std::thread thread;
+};
+
+void start_audio_thread(AudioThread * t, SoundQueue * q, AudioSink * sink);
+// Plays whatever is still queued, then joins
+void stop_audio_thread(AudioThread * t);
+
+#endif
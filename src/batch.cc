@@ -0,0 +1,66 @@
+#include "batch.h"
+
+// splitmix32-style scramble so neighbouring instances don't start
+// from neighbouring xorshift states
+static uint32_t instance_seed(uint32_t seed, int i)
+{
+	uint32_t z = seed + 0x9E3779B9 * (uint32_t) (i + 1);
+	z = (z ^ (z >> 16)) * 0x85EBCA6B;
+	z = (z ^ (z >> 13)) * 0xC2B2AE35;
+	return z ^ (z >> 16);
+}
+
+void make_batch(Batch * batch, int count, uint32_t seed, int worker_count)
+{
+	batch->count  = count;
+	batch->sims   = new Sim[count];
+	batch->queues = new SoundQueue[count];
+	batch->sinks  = new AudioSink[count];
+	batch->inputs = new Input[count];
+	for (int i = 0; i < count; i++) {
+		make_sim(batch->sims + i, instance_seed(seed, i));
+		make_sound_queue(batch->queues + i);
+		make_audio_sink(batch->sinks + i);
+		batch->sims[i].sounds = batch->queues + i;
+		batch->inputs[i].key_count = 0;
+	}
+	make_pool(&batch->pool, worker_count);
+}
+
+void destroy_batch(Batch * batch)
+{
+	destroy_pool(&batch->pool);
+	for (int i = 0; i < batch->count; i++) {
+		destroy_sim(batch->sims + i);
+	}
+	delete[] batch->sims;
+	delete[] batch->queues;
+	delete[] batch->sinks;
+	delete[] batch->inputs;
+}
+
+void batch_use_level_pack(Batch * batch, const LevelPack * pack)
+{
+	for (int i = 0; i < batch->count; i++) {
+		make_sim(batch->sims + i, batch->sims[i].seed);
+		batch->sims[i].sounds = batch->queues + i;
+		sim_use_level_pack(batch->sims + i, pack);
+	}
+}
+
+static void step_one(void * data, int i)
+{
+	Batch * batch = (Batch*) data;
+	step(batch->sims + i, batch->inputs[i], batch->dt);
+	batch->inputs[i].key_count = 0;
+}
+
+void batch_step(Batch * batch, float dt)
+{
+	batch->dt = dt;
+	pool_for(&batch->pool, batch->count, step_one, batch);
+	// pool_for has returned, so every producer is done for this step
+	for (int i = 0; i < batch->count; i++) {
+		audio_drain(batch->queues + i, batch->sinks + i);
+	}
+}
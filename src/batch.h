@@ -0,0 +1,32 @@
+#ifndef NES_BATCH_H
+#define NES_BATCH_H
+
+// Runs many independent games side by side. Every Sim owns its own
+// Rng and state, so they can be stepped on any thread in any order.
+
+#include "sim.h"
+#include "audio.h"
+#include "pool.h"
+
+struct Batch {
+	int count;
+	Sim * sims;
+	// Sim i pushes its sounds onto queues[i]; batch_step drains them
+	// all into the null sinks[i], which just count
+	SoundQueue * queues;
+	AudioSink * sinks;
+	// Filled in by the caller before each batch_step, cleared after
+	Input * inputs;
+	float dt;
+	Pool pool;
+};
+
+// Instance i is seeded from seed and i, so a batch is reproducible
+// regardless of how many threads it runs on.
+void make_batch(Batch * batch, int count, uint32_t seed, int worker_count = 0);
+void destroy_batch(Batch * batch);
+void batch_step(Batch * batch, float dt);
+// Restarts every game on levels from the pack (see sim_use_level_pack)
+void batch_use_level_pack(Batch * batch, const LevelPack * pack);
+
+#endif
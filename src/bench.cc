@@ -0,0 +1,438 @@
+// Headless microbenchmarks. Build and run with `make bench`, or pass
+// a substring to only run matching benchmarks: bin/bench a_star
+//
+// Allocation counts come from wrapping malloc & co at link time (see
+// the bench target), so they cover everything compiled into this
+// binary but not allocations made inside shared libraries.
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "sim.h"
+#include "astar.h"
+#include "heap.h"
+#include "batch.h"
+#include "soft_render.h"
+#include "observe.h"
+#include "arena.h"
+#include "hpa.h"
+#include "arena_ghosts.h"
+#include "levelpack.h"
+
+static long alloc_count = 0;
+
+extern "C" {
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t n, size_t size);
+void * __real_realloc(void * p, size_t size);
+
+void * __wrap_malloc(size_t size)
+{
+	__atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void * __wrap_calloc(size_t n, size_t size)
+{
+	__atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __real_calloc(n, size);
+}
+
+void * __wrap_realloc(void * p, size_t size)
+{
+	__atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __real_realloc(p, size);
+}
+}
+
+// Route new/delete through the counted malloc too
+void * operator new(size_t size)
+{
+	void * p = malloc(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+void * operator new[](size_t size) { return operator new(size); }
+void operator delete(void * p) noexcept { free(p); }
+void operator delete[](void * p) noexcept { free(p); }
+void operator delete(void * p, size_t) noexcept { free(p); }
+void operator delete[](void * p, size_t) noexcept { free(p); }
+
+typedef std::chrono::steady_clock Clock;
+
+static const char * filter = NULL;
+
+static bool wanted(const char * name)
+{
+	return !filter || strstr(name, filter);
+}
+
+// Runs body() ops_per_sample times per sample and reports the mean,
+// median and 99th percentile of the per-sample ns/op.
+template <typename F>
+void bench(const char * name, int samples, int ops_per_sample, F body)
+{
+	if (!wanted(name)) return;
+	// Warm up caches and any grow-only buffers
+	for (int i = 0; i < ops_per_sample; i++) body();
+
+	std::vector<double> ns(samples);
+	long allocs_before = alloc_count;
+	double total = 0;
+	for (int s = 0; s < samples; s++) {
+		Clock::time_point t0 = Clock::now();
+		for (int i = 0; i < ops_per_sample; i++) body();
+		double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+		ns[s] = elapsed / ops_per_sample;
+		total += elapsed;
+	}
+	long ops = (long) samples * ops_per_sample;
+	double allocs = (double) (alloc_count - allocs_before) / ops;
+	std::sort(ns.begin(), ns.end());
+	printf("%-36s %12.1f %12.1f %12.1f %10.2f\n", name,
+		total / ops, ns[samples / 2], ns[(samples * 99) / 100], allocs);
+}
+
+static Vector2i random_open(const int * grid, int w, int h, Rng * rng)
+{
+	Vector2i p;
+	do {
+		p.x = rng_range(rng, w);
+		p.y = rng_range(rng, h);
+	} while (grid[p.x + p.y * w]);
+	return p;
+}
+
+static void bench_a_star()
+{
+	Rng rng;
+	rng_seed(&rng, 1);
+	const int maze_count = 64;
+	std::vector<Level> mazes(maze_count);
+	for (int i = 0; i < maze_count; i++) generate_level(&mazes[i], &rng);
+
+	PathScratch scratch;
+	make_path_scratch(&scratch, 64, 64);
+	int m = 0;
+	bench("a_star 16x13 maze (List)", 200, 256, [&] {
+		const Level * l = &mazes[m++ % maze_count];
+		List<Vector2i> p = a_star(l->grid, Level::play_w, Level::play_h,
+			random_open(l->grid, Level::play_w, Level::play_h, &rng),
+			random_open(l->grid, Level::play_w, Level::play_h, &rng));
+		p.dealloc();
+	});
+	Vector2i path[256];
+	bench("a_star 16x13 maze (scratch)", 200, 256, [&] {
+		const Level * l = &mazes[m++ % maze_count];
+		a_star_path(&scratch, l->grid, Level::play_w, Level::play_h,
+			random_open(l->grid, Level::play_w, Level::play_h, &rng),
+			random_open(l->grid, Level::play_w, Level::play_h, &rng),
+			path, 256);
+	});
+
+	// 30% random walls, corner to corner
+	std::vector<int> open_grid(64 * 64);
+	for (size_t i = 0; i < open_grid.size(); i++) open_grid[i] = rng_range(&rng, 100) < 30;
+	open_grid[0] = 0;
+	open_grid[64 * 64 - 1] = 0;
+	bench("a_star 64x64 random (scratch)", 100, 16, [&] {
+		a_star_path(&scratch, open_grid.data(), 64, 64,
+			Vector2i(0, 0), Vector2i(63, 63), path, 256);
+	});
+	destroy_path_scratch(&scratch);
+}
+
+static void bench_generate_level()
+{
+	Rng rng;
+	rng_seed(&rng, 2);
+	Level level;
+	bench("generate_level", 200, 64, [&] {
+		generate_level(&level, &rng);
+	});
+	NextHopTable hops;
+	make_next_hop_table(&hops, 1 << 20);
+	bench("generate_level + next-hop table", 100, 16, [&] {
+		generate_level(&level, &rng, &hops);
+	});
+	destroy_next_hop_table(&hops);
+
+	// Same generator on big grids, to check it stays linear
+	int sizes[] = { 256, 1024 };
+	for (int s = 0; s < 2; s++) {
+		int n = sizes[s];
+		char name[64];
+		std::vector<int> grid(n * n);
+		std::vector<int> frontier(n * n);
+		std::vector<uint64_t> queued((n * n + 63) / 64);
+		snprintf(name, sizeof(name), "carve_maze %dx%d", n, n);
+		bench(name, 10, 1, [&] {
+			std::fill(grid.begin(), grid.end(), 1);
+			carve_maze(grid.data(), n, n, Vector2i(1, 1), &rng, frontier.data(), queued.data());
+		});
+	}
+}
+
+// Same level switch as above, out of a pre-generated pack. Written to
+// bin/, since that's where the benchmarks get built.
+static void bench_level_pack()
+{
+	if (!wanted("load_pack_level") && !wanted("load_pack_level + next-hop table")) return;
+	const char * path = "bin/bench.pack";
+	LevelPack pack;
+	if (!write_level_pack(path, 64, 2, PACK_HOPS) || !open_level_pack(&pack, path)) {
+		printf("(skipping level pack, couldn't write %s)\n", path);
+		return;
+	}
+	Sim sim;
+	make_sim(&sim, 2);
+	int i = 0;
+	bench("load_pack_level", 200, 64, [&] {
+		load_pack_level(&sim, &pack, pack_level(&pack, i++ % 64));
+	});
+	NextHopTable hops;
+	make_next_hop_table(&hops, 1 << 20);
+	sim_use_next_hops(&sim, &hops);
+	bench("load_pack_level + next-hop table", 100, 16, [&] {
+		load_pack_level(&sim, &pack, pack_level(&pack, i++ % 64));
+	});
+	destroy_next_hop_table(&hops);
+	destroy_sim(&sim);
+	close_level_pack(&pack);
+	remove(path);
+}
+
+static Vector2i random_open(const Arena * a, Rng * rng)
+{
+	Vector2i p;
+	do {
+		p.x = rng_range(rng, a->width);
+		p.y = rng_range(rng, a->height);
+	} while (!arena_open(a, p.x, p.y));
+	return p;
+}
+
+static void bench_arena()
+{
+	Rng rng;
+	rng_seed(&rng, 7);
+	int sizes[] = { 256, 4096 };
+	for (int s = 0; s < 2; s++) {
+		int n = sizes[s];
+		char gen_name[64], build_name[64], hpa_name[64], ghosts_name[64], flat_name[64];
+		snprintf(gen_name, sizeof(gen_name), "generate_arena %dx%d", n, n);
+		snprintf(build_name, sizeof(build_name), "build_hpa %dx%d", n, n);
+		snprintf(hpa_name, sizeof(hpa_name), "hpa_first_step %dx%d", n, n);
+		snprintf(ghosts_name, sizeof(ghosts_name), "step_arena_ghosts %dx%d, 64", n, n);
+		snprintf(flat_name, sizeof(flat_name), "a_star_first_step %dx%d arena", n, n);
+		// Setting up the big one takes seconds, so skip it unless
+		// something here is going to run
+		if (!wanted(gen_name) && !wanted(build_name) && !wanted(hpa_name) &&
+			!wanted(ghosts_name) && !(n <= 1024 && wanted(flat_name))) {
+			continue;
+		}
+		Arena arena;
+		make_arena(&arena, n, n);
+		Hpa hpa;
+		make_hpa(&hpa);
+		// Only time the big one once
+		int build_samples = n > 1024 ? 1 : 20;
+		if (wanted(gen_name)) {
+			bench(gen_name, build_samples, 1, [&] {
+				generate_arena(&arena, &rng);
+			});
+		} else {
+			generate_arena(&arena, &rng);
+		}
+		if (wanted(build_name)) {
+			bench(build_name, build_samples, 1, [&] {
+				build_hpa(&hpa, &arena);
+			});
+		} else {
+			build_hpa(&hpa, &arena);
+		}
+		HpaScratch scratch;
+		make_hpa_scratch(&scratch, &hpa);
+		Vector2i step;
+		bench(hpa_name, 100, n > 1024 ? 2 : 32, [&] {
+			hpa_first_step(&hpa, &arena, &scratch,
+				random_open(&arena, &rng), random_open(&arena, &rng), &step);
+		});
+		// The same long-range queries as a crowd chasing one target,
+		// through the route cache. The warm-up step pays for the
+		// searches; after that a step is a few floods per ghost.
+		if (wanted(ghosts_name)) {
+			ArenaGhosts ghosts;
+			make_arena_ghosts(&ghosts, &arena, &hpa, &rng, 64);
+			Vector2i target = random_open(&arena, &rng);
+			bench(ghosts_name, 100, 1, [&] {
+				step_arena_ghosts(&ghosts, &arena, &hpa, target);
+			});
+			destroy_arena_ghosts(&ghosts);
+		}
+		if (n <= 1024) {
+			// The flat search it replaces, on the same map
+			std::vector<int> grid(n * n);
+			for (int y = 0; y < n; y++) {
+				for (int x = 0; x < n; x++) grid[x + y * n] = !arena_open(&arena, x, y);
+			}
+			PathScratch flat;
+			make_path_scratch(&flat, n, n);
+			bench(flat_name, 100, 32, [&] {
+				a_star_first_step(&flat, grid.data(), n, n,
+					random_open(&arena, &rng), random_open(&arena, &rng), &step);
+			});
+			destroy_path_scratch(&flat);
+		}
+		destroy_hpa_scratch(&scratch);
+		destroy_hpa(&hpa);
+		destroy_arena(&arena);
+	}
+}
+
+static void bench_heap()
+{
+	auto less = [](int a, int b) { return a < b; };
+	int sizes[] = { 16, 256, 4096, 65536 };
+	for (int s = 0; s < 4; s++) {
+		int n = sizes[s];
+		char name[64];
+		Rng rng;
+		rng_seed(&rng, 3);
+		List<int> heap;
+		heap.alloc();
+		for (int i = 0; i < n; i++) heap_insert(&heap, (int) rng_next(&rng), less);
+		// One insert + one pop keeps the heap at size n
+		snprintf(name, sizeof(name), "heap insert+pop n=%d", n);
+		bench(name, 200, 1024, [&] {
+			heap_insert(&heap, (int) rng_next(&rng), less);
+			heap_pop(&heap, less);
+		});
+		snprintf(name, sizeof(name), "heap<4> insert+pop n=%d", n);
+		bench(name, 200, 1024, [&] {
+			heap_insert<4>(&heap, (int) rng_next(&rng), less);
+			heap_pop<4>(&heap, less);
+		});
+		heap.dealloc();
+	}
+}
+
+static void bench_collision()
+{
+	int counts[] = { 5, 16, SIM_MAX_GHOSTS };
+	for (int c = 0; c < 3; c++) {
+		Sim sim;
+		make_sim(&sim, 4);
+		for (int i = 0; i < counts[c]; i++) {
+			// Never the player's power, so nothing dies mid-benchmark
+			add_ghost(&sim, random_open(sim.level.grid, Level::play_w, Level::play_h, &sim.rng), 7, 0.3);
+		}
+		sim.player.power_level = 0;
+		char name[64];
+		snprintf(name, sizeof(name), "check_collision ghosts=%d", counts[c]);
+		bench(name, 200, 256, [&] {
+			sim.game_state = GAME_PLAYING;
+			check_collision(&sim);
+		});
+		destroy_sim(&sim);
+	}
+}
+
+static void bench_step()
+{
+	Sim sim;
+	make_sim(&sim, 5);
+	// Jump to the last level so the full ghost count is out
+	sim.player.power_max = 7;
+	sim.player.power_level = 7;
+	generate_ghosts(&sim, 7);
+	Input input;
+	int frame = 0;
+	bench("step (headless frame)", 500, 256, [&] {
+		// Dying resets to the ghost-free first level; put them back so
+		// we keep measuring a busy frame. Happens every few hundred
+		// frames, so it barely shows in the numbers.
+		if (sim.ghosts.count == 0) generate_ghosts(&sim, 7);
+		input.key_count = 0;
+		if (frame++ % 16 == 0) input_push(&input, (Key) (frame / 16 % 4));
+		step(&sim, input, 1.0f / 60.0f);
+	});
+
+	SnapshotPool pool;
+	make_snapshot_pool(&pool, 4096);
+	bench("snapshot_push", 200, 4096, [&] {
+		if (snapshot_push(&pool, &sim) == -1) {
+			snapshot_pool_clear(&pool);
+			snapshot_push(&pool, &sim);
+		}
+	});
+	Sim clone;
+	make_sim(&clone, 5);
+	bench("snapshot_clone", 200, 4096, [&] {
+		snapshot_clone(&pool, 0, &clone);
+	});
+	destroy_snapshot_pool(&pool);
+	destroy_sim(&clone);
+	destroy_sim(&sim);
+
+	Batch batch;
+	make_batch(&batch, 1024, 6);
+	bench("batch_step (1024 games)", 50, 4, [&] {
+		batch_step(&batch, 1.0f / 60.0f);
+	});
+	destroy_batch(&batch);
+}
+
+static void bench_soft_render()
+{
+	SoftRender r;
+	if (!make_soft_render(&r, "atlas.png", Vector2i(256, 240))) {
+		printf("(skipping soft_render, run from the repo root)\n");
+		return;
+	}
+	Sim sim;
+	make_sim(&sim, 5);
+	sim.player.power_max = 7;
+	sim.player.power_level = 7;
+	generate_ghosts(&sim, 7);
+	bench("soft_render_sim 256x240", 200, 64, [&] {
+		soft_render_sim(&r, &sim);
+	});
+	static uint8_t indexed[256 * 240];
+	bench("soft_render_sim_indexed 256x240", 200, 64, [&] {
+		soft_render_sim_indexed(&r, &sim, indexed);
+	});
+	uint8_t tiles[OBSERVE_TILES];
+	bench("observe_tiles 16x13", 200, 4096, [&] {
+		observe_tiles(&sim, tiles);
+	});
+	ObserveEntity entities[OBSERVE_ENTITIES];
+	bench("observe_entities", 200, 4096, [&] {
+		observe_entities(&sim, entities);
+	});
+	bench("soft_render 16x16 sprite", 200, 4096, [&] {
+		soft_render(&r, sim.player.pos, sim.player.tex.pos, sim.player.tex.dim, sim.player.tex.scale);
+	});
+	destroy_sim(&sim);
+	destroy_soft_render(&r);
+}
+
+int main(int argc, char ** argv)
+{
+	if (argc > 1) filter = argv[1];
+	printf("%-36s %12s %12s %12s %10s\n", "benchmark", "ns/op", "p50", "p99", "allocs/op");
+	bench_a_star();
+	bench_generate_level();
+	bench_level_pack();
+	bench_arena();
+	bench_heap();
+	bench_collision();
+	bench_step();
+	bench_soft_render();
+	return 0;
+}
@@ -0,0 +1,208 @@
+#ifndef NES_BITBOARD_H
+#define NES_BITBOARD_H
+
+// One bit per cell, set for open floor. Each row is padded out to a
+// whole number of words: the 16-wide level is exactly one uint16_t
+// per row, wider maps use several (uint64_t) words per row. Padding
+// bits are always clear, so anything shifted into them gets masked
+// off by the open bits.
+//
+// bitboard_bfs grows the frontier a whole row of words at a time with
+// shifts and masks, instead of visiting cells one by one.
+
+#include <stdint.h>
+#include <string.h>
+
+template <typename W>
+inline bool bitboard_get(const W * bits, int stride, int x, int y)
+{
+	const int B = sizeof(W) * 8;
+	return (bits[y * stride + x / B] >> (x % B)) & 1;
+}
+
+template <typename W>
+inline void bitboard_set(W * bits, int stride, int x, int y)
+{
+	const int B = sizeof(W) * 8;
+	bits[y * stride + x / B] |= (W) ((W) 1 << (x % B));
+}
+
+// Packs an int grid (non-zero = wall) into open bits. Returns the
+// number of words written.
+template <typename W>
+int bitboard_from_grid(W * bits, const int * grid, int width, int height)
+{
+	const int B = sizeof(W) * 8;
+	int stride = (width + B - 1) / B;
+	memset(bits, 0, sizeof(W) * stride * height);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			if (!grid[x + y * width]) bitboard_set(bits, stride, x, y);
+		}
+	}
+	return stride * height;
+}
+
+template <typename W>
+inline int bitboard_ctz(W w)
+{
+	return sizeof(W) > sizeof(unsigned int) ?
+		__builtin_ctzll((unsigned long long) w) :
+		__builtin_ctz((unsigned int) w);
+}
+
+// Breadth-first distances from target over the open bits. dist gets
+// -1 for unreachable cells. If next isn't NULL it gets the direction
+// (0 UP, 1 LEFT, 2 DOWN, 3 RIGHT) of the first step back toward
+// target, or 0xFF where there isn't one. scratch must hold
+// 3 * stride * height words.
+template <typename W>
+void bitboard_bfs(
+	const W * open, int width, int height, int stride,
+	int target_x, int target_y,
+	int16_t * dist, uint8_t * next, W * scratch)
+{
+	const int B = sizeof(W) * 8;
+	int words = stride * height;
+	W * visited  = scratch;
+	W * frontier = scratch + words;
+	W * layer    = scratch + words * 2;
+	// All ones is -1 in int16_t
+	memset(dist, 0xFF, sizeof(int16_t) * width * height);
+	if (next) memset(next, 0xFF, width * height);
+	if (!bitboard_get(open, stride, target_x, target_y)) return;
+
+	memset(frontier, 0, sizeof(W) * words);
+	memset(layer, 0, sizeof(W) * words);
+	bitboard_set(frontier, stride, target_x, target_y);
+	memcpy(visited, frontier, sizeof(W) * words);
+	dist[target_x + target_y * width] = 0;
+
+	// Scatters one row's worth of newly reached bits into dist/next
+	auto emit = [&](W bits, int y, int w, int16_t d, uint8_t dir) {
+		while (bits) {
+			int x = w * B + bitboard_ctz(bits);
+			bits &= bits - 1;
+			dist[x + y * width] = d;
+			if (next) next[x + y * width] = dir;
+		}
+	};
+
+	// Only rows next to the last layer can change, so just sweep the
+	// band around it.
+	int lo_row = target_y, hi_row = target_y;
+	for (int16_t d = 1; ; d++) {
+		int y0 = lo_row > 0 ? lo_row - 1 : 0;
+		int y1 = hi_row < height - 1 ? hi_row + 1 : height - 1;
+		lo_row = height;
+		hi_row = -1;
+		for (int y = y0; y <= y1; y++) {
+			const W * row  = frontier + y * stride;
+			const W * up   = y > 0          ? frontier + (y - 1) * stride : NULL;
+			const W * down = y < height - 1 ? frontier + (y + 1) * stride : NULL;
+			for (int w = 0; w < stride; w++) {
+				int i = y * stride + w;
+				layer[i] = 0;
+				W free_bits = (W) (open[i] & ~visited[i]);
+				if (!free_bits) continue;
+				W prev = w > 0 ? row[w - 1] : 0;
+				W post = w < stride - 1 ? row[w + 1] : 0;
+				W east = (W) (row[w] << 1) | (W) (prev >> (B - 1));
+				W west = (W) (row[w] >> 1) | (W) (post << (B - 1));
+				// A cell reached from the frontier cell above it
+				// steps UP to get back, and so on. Priority order
+				// matches the directions table.
+				W from_up    = up   ? (W) (up[w]   & free_bits) : 0;
+				W from_left  = (W) (east & free_bits & ~from_up);
+				W from_down  = down ? (W) (down[w] & free_bits & ~from_up & ~from_left) : 0;
+				W from_right = (W) (west & free_bits & ~from_up & ~from_left & ~from_down);
+				W reached = (W) (from_up | from_left | from_down | from_right);
+				if (!reached) continue;
+				layer[i] = reached;
+				if (y < lo_row) lo_row = y;
+				if (y > hi_row) hi_row = y;
+				emit(from_up,    y, w, d, 0);
+				emit(from_left,  y, w, d, 1);
+				emit(from_down,  y, w, d, 2);
+				emit(from_right, y, w, d, 3);
+			}
+		}
+		if (hi_row < 0) break;
+		for (int y = y0; y <= y1; y++) {
+			for (int w = 0; w < stride; w++) {
+				visited[y * stride + w] |= layer[y * stride + w];
+			}
+		}
+		// The old frontier's rows outside the new band must read as
+		// empty next time round, so clear it before swapping.
+		for (int y = y0; y <= y1; y++) {
+			memset(frontier + y * stride, 0, sizeof(W) * stride);
+		}
+		W * t = frontier;
+		frontier = layer;
+		layer = t;
+	}
+}
+
+// Specialisation for boards at most 16x16, one uint16_t per row (16
+// rows, unused ones zero). The whole board is four 64-bit words, bit
+// y * 16 + x, so each BFS layer is a handful of shifts and masks.
+inline void bitboard_bfs16(
+	const uint16_t open_rows[16], int width, int height,
+	int target_x, int target_y, int16_t * dist, uint8_t * next)
+{
+	memset(dist, 0xFF, sizeof(int16_t) * width * height);
+	if (next) memset(next, 0xFF, width * height);
+	uint64_t open[4];
+	memcpy(open, open_rows, sizeof(open));
+	int t = target_x + target_y * 16;
+	if (!((open[t >> 6] >> (t & 63)) & 1)) return;
+
+	const uint64_t not_col0  = 0xFFFEFFFEFFFEFFFEull;
+	const uint64_t not_col15 = 0x7FFF7FFF7FFF7FFFull;
+	uint64_t frontier[4] = {0, 0, 0, 0};
+	frontier[t >> 6] = 1ull << (t & 63);
+	uint64_t visited[4] = {frontier[0], frontier[1], frontier[2], frontier[3]};
+	dist[target_x + target_y * width] = 0;
+
+	for (int16_t d = 1; ; d++) {
+		uint64_t any = 0;
+		uint64_t layer[4];
+		for (int w = 0; w < 4; w++) {
+			uint64_t f = frontier[w];
+			uint64_t prev = w > 0 ? frontier[w - 1] : 0;
+			uint64_t post = w < 3 ? frontier[w + 1] : 0;
+			uint64_t free_bits = open[w] & ~visited[w];
+			if (!(f | prev | post) || !free_bits) {
+				layer[w] = 0;
+				continue;
+			}
+			// Same priority as the directions table: a cell below a
+			// frontier cell steps UP to get back, and so on.
+			uint64_t from_up    = ((f << 16) | (prev >> 48)) & free_bits;
+			uint64_t from_left  = (f << 1) & not_col0 & free_bits & ~from_up;
+			uint64_t from_down  = ((f >> 16) | (post << 48)) & free_bits & ~from_up & ~from_left;
+			uint64_t from_right = (f >> 1) & not_col15 & free_bits & ~from_up & ~from_left & ~from_down;
+			uint64_t masks[4] = {from_up, from_left, from_down, from_right};
+			layer[w] = from_up | from_left | from_down | from_right;
+			any |= layer[w];
+			for (int dir = 0; dir < 4; dir++) {
+				uint64_t bits = masks[dir];
+				while (bits) {
+					int b = w * 64 + __builtin_ctzll(bits);
+					bits &= bits - 1;
+					int i = (b & 15) + (b >> 4) * width;
+					dist[i] = d;
+					if (next) next[i] = dir;
+				}
+			}
+		}
+		if (!any) break;
+		for (int w = 0; w < 4; w++) {
+			visited[w] |= layer[w];
+			frontier[w] = layer[w];
+		}
+	}
+}
+
+#endif
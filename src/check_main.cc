@@ -0,0 +1,183 @@
+// Headless rule checks: small scripted games with a known outcome.
+// Prints each check and exits non-zero if any fail.
+//
+//   bin/check
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "audio.h"
+#include "nexthop.h"
+#include "arena_ghosts.h"
+
+static int failures = 0;
+
+static void expect(bool ok, const char * what)
+{
+	printf("%s  %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) failures++;
+}
+
+// Walls everywhere but row 1, from x = 1 to x = 6
+static void corridor_level(Sim * sim, Vector2i crystal)
+{
+	Level * l = &sim->level;
+	for (int i = 0; i < Level::play_w * Level::play_h; i++) l->grid[i] = 1;
+	for (int x = 1; x <= 6; x++) l->grid[to_index(x, 1)] = 0;
+	memset(l->open_rows, 0, sizeof(l->open_rows));
+	bitboard_from_grid(l->open_rows, l->grid, Level::play_w, Level::play_h);
+	l->crystal_pos = crystal;
+	l->generation++;
+}
+
+static void step_key(Sim * sim, int frames, const Key * key)
+{
+	for (int f = 0; f < frames; f++) {
+		Input input;
+		input.key_count = 0;
+		if (key && f == 0) input_push(&input, *key);
+		step(sim, input, SIM_DT);
+	}
+}
+
+// Walk right from (1, 1) towards a crystal at (3, 1), and turn back
+// halfway into the step onto it. The player never stands on the
+// crystal, so it mustn't count as grabbed.
+static void check_reversal_short_of_crystal()
+{
+	Sim sim;
+	make_sim(&sim, 1);
+	sim.flags |= SIM_PRE_TURN;
+	SoundQueue sounds;
+	make_sound_queue(&sounds);
+	sim.sounds = &sounds;
+	corridor_level(&sim, Vector2i(3, 1));
+
+	// One tile takes move_div seconds
+	int tile_frames = (int) (sim.player.move_div / SIM_DT) + 1;
+	Key right = KEY_RIGHT;
+	Key left = KEY_LEFT;
+	step_key(&sim, tile_frames, &right);
+	expect(sim.player.grid_pos.x == 2, "reversal: reached the tile before the crystal");
+	step_key(&sim, tile_frames / 2, NULL);
+	expect(sim.player.moving && sim.player.pos.x > 2 * 16,
+		"reversal: halfway onto the crystal's tile");
+
+	step_key(&sim, 1, &left);
+	step_key(&sim, tile_frames * 2, NULL);
+	AudioSink sink;
+	make_audio_sink(&sink);
+	audio_drain(&sounds, &sink);
+	expect(sink.counts[SOUND_CRYSTAL_GRAB] == 0 && sim.player.power_max == -1,
+		"reversal: crystal not grabbed");
+	expect(sim.player.grid_pos.x < 3 && !sim.player.moving && sim.player.pos.x == sim.player.grid_pos.x * 16,
+		"reversal: came to rest back on a tile it reached");
+	destroy_sim(&sim);
+}
+
+// The same walk without turning back does grab it
+static void check_walk_onto_crystal()
+{
+	Sim sim;
+	make_sim(&sim, 1);
+	sim.flags |= SIM_PRE_TURN;
+	corridor_level(&sim, Vector2i(3, 1));
+	int tile_frames = (int) (sim.player.move_div / SIM_DT) + 1;
+	Key right = KEY_RIGHT;
+	step_key(&sim, tile_frames * 2 + 1, &right);
+	expect(sim.player.power_max == 0, "walk: crystal grabbed on reaching its tile");
+	destroy_sim(&sim);
+}
+
+// Two branches off one snapshot that each roll a new level end up on
+// the same generation with different mazes. Restoring one into the
+// other has to bring the next-hop table along to the new layout.
+static void check_restore_across_branches()
+{
+	Sim a, b, snapshot;
+	NextHopTable a_hops, b_hops;
+	make_next_hop_table(&a_hops, 1 << 20);
+	make_next_hop_table(&b_hops, 1 << 20);
+	make_sim(&a, 1);
+	sim_use_next_hops(&a, &a_hops);
+	make_sim(&b, 2);
+	sim_use_next_hops(&b, &b_hops);
+	sim_snapshot(&a, &snapshot);
+
+	rng_range(&a.rng, 100);
+	generate_level(&a.level, &a.rng, a.hops);
+	sim_restore(&b, &snapshot);
+	generate_level(&b.level, &b.rng, b.hops);
+	expect(a.level.generation == b.level.generation &&
+		memcmp(a.level.open_rows, b.level.open_rows, sizeof(a.level.open_rows)),
+		"restore: branches share a generation but not a maze");
+
+	sim_restore(&a, &b);
+	expect(a_hops.cell_count == b_hops.cell_count &&
+		!memcmp(a_hops.dirs, b_hops.dirs, (size_t) b_hops.cell_count * b_hops.row_bytes) &&
+		!memcmp(a_hops.dist, b_hops.dist, (size_t) b_hops.cell_count * b_hops.cell_count),
+		"restore: next-hop table follows the restored maze");
+	destroy_sim(&a);
+	destroy_sim(&b);
+	destroy_next_hop_table(&a_hops);
+	destroy_next_hop_table(&b_hops);
+}
+
+// A crowd on a big maze, routed through the HPA route cache, has to
+// walk open cells one at a time and all end up on the target without
+// going round in circles
+static void check_arena_ghosts_arrive()
+{
+	Rng rng;
+	rng_seed(&rng, 3);
+	Arena arena;
+	make_arena(&arena, 256, 256);
+	generate_arena(&arena, &rng);
+	Hpa hpa;
+	make_hpa(&hpa);
+	build_hpa(&hpa, &arena);
+	ArenaGhosts ghosts;
+	make_arena_ghosts(&ghosts, &arena, &hpa, &rng, 32);
+	Vector2i target = ghosts.pos[0];
+	ghosts.pos[0] = ghosts.pos[ghosts.count - 1];
+
+	// Cached routes can be a little longer than a fresh search's, but
+	// never by half
+	int longest = 0;
+	for (int i = 0; i < ghosts.count; i++) {
+		Vector2i step;
+		int len = hpa_first_step(&hpa, &arena, &ghosts.scratch, ghosts.pos[i], target, &step);
+		if (len > longest) longest = len;
+	}
+	bool on_open = true;
+	int arrived = 0;
+	for (int s = 0; s < longest * 3 / 2 && arrived < ghosts.count; s++) {
+		Vector2i before[32];
+		memcpy(before, ghosts.pos, sizeof(before));
+		arrived = step_arena_ghosts(&ghosts, &arena, &hpa, target);
+		for (int i = 0; i < ghosts.count; i++) {
+			Vector2i d = ghosts.pos[i] - before[i];
+			if (!arena_open(&arena, ghosts.pos[i].x, ghosts.pos[i].y) || abs(d.x) + abs(d.y) > 1) {
+				on_open = false;
+			}
+		}
+	}
+	expect(on_open, "arena: ghosts step between neighbouring open cells");
+	expect(arrived == ghosts.count, "arena: every ghost reaches the target");
+	expect(ghosts.cache.hits > ghosts.cache.misses, "arena: most steps come out of the route cache");
+	destroy_arena_ghosts(&ghosts);
+	destroy_hpa(&hpa);
+	destroy_arena(&arena);
+}
+
+int main()
+{
+	check_reversal_short_of_crystal();
+	check_walk_onto_crystal();
+	check_restore_across_branches();
+	check_arena_ghosts_arrive();
+	if (failures) printf("%d check(s) failed\n", failures);
+	return failures ? 1 : 0;
+}
@@ -2,109 +2,268 @@
 #define HEAP_H
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
 
-#define SWAP(T, a, b) { T __t = a; a = b; b = __t; }
+// All of these take the comparator as a template type, so a lambda or
+// functor gets inlined into the sift loops; plain function pointers
+// still work. compare(a, b) is true when a belongs above b. D is the
+// arity: 2 for a binary heap, 4 trades a deeper compare per level for
+// half as many levels, which tends to win when compares are cheap.
 
-template <typename T>
-bool heap_test(List<T> * heap, bool(compare)(T, T))
+template <int D>
+inline int heap_parent(int pos)
+{
+	return (pos - 1) / D;
+}
+
+template <int D>
+inline int heap_first_child(int pos)
+{
+	return D * pos + 1;
+}
+
+template <int D = 2, typename T, typename Compare>
+bool heap_test(List<T> * heap, Compare compare)
 {
 	for (int i = 1; i < heap->len; i++) {
-		int p = (i - 1) / 2;
+		int p = heap_parent<D>(i);
 		if (compare((*heap)[i], (*heap)[p])) {
 			printf("Pos %d is larger than pos %d. "
-				"Heap test failed.", i, p);
+				"Heap test failed.\n", i, p);
+			return false;
 		}
-		return false;
 	}
 	return true;
 }
 
-// TODO(pixlark): We can optimize this by searching on a
-// branch-by-branch basis, and stopping search on a branch if we reach
-// vertices with values that pass the value we are searching for based
-// on the passed comparison function.
-#if 0
-// For now, just use List.find()
-template <typename T>
-int heap_find(List<T> * heap, T item, bool(equality)(T, T), bool(compare)(T, T))
+// Moves the item at pos up until its parent beats it. Uses a hole
+// rather than swaps, so each level is one move instead of three.
+template <int D = 2, typename T, typename Compare>
+void heap_sift_up(T * arr, int pos, Compare compare)
 {
-	for (int i = 0; i < heap->len; i++) {
-		if (equality((*heap)[i], item)) {
-			return i;
-		}
+	T item = std::move(arr[pos]);
+	while (pos != 0) {
+		int parent_pos = heap_parent<D>(pos);
+		if (!compare(item, arr[parent_pos])) break;
+		arr[pos] = std::move(arr[parent_pos]);
+		pos = parent_pos;
 	}
-	return -1;
+	arr[pos] = std::move(item);
 }
-#endif
 
-template <typename T>
-void heap_insert(List<T> * heap, T item, bool(compare)(T, T))
+template <int D = 2, typename T, typename Compare>
+void heap_sift_down(T * arr, int len, int pos, Compare compare)
 {
-	int pos = heap->len;
-	heap->push(item);
-	while (pos != 0) {
-		int parent_pos = (pos - 1) / 2;
-		if (!compare((*heap)[parent_pos], (*heap)[pos])) {
-			SWAP(T, (*heap)[parent_pos], (*heap)[pos]);
-			pos = parent_pos;
-		} else {
-			break;
+	T item = std::move(arr[pos]);
+	while (1) {
+		int first = heap_first_child<D>(pos);
+		if (first >= len) break;
+		int best = first;
+		int last = first + D < len ? first + D : len;
+		for (int c = first + 1; c < last; c++) {
+			if (compare(arr[c], arr[best])) best = c;
 		}
+		if (!compare(arr[best], item)) break;
+		arr[pos] = std::move(arr[best]);
+		pos = best;
 	}
+	arr[pos] = std::move(item);
 }
 
-template <typename T>
-T heap_pop(List<T> * heap, bool(compare)(T, T))
+// Searches branch by branch, and stops going down a branch once its
+// root already beats item -- nothing below it can be equal to item.
+template <int D = 2, typename T, typename Equality, typename Compare>
+int heap_find(List<T> * heap, const T & item, Equality equality, Compare compare, int pos = 0)
 {
-	T popped = (*heap)[0];
-	(*heap)[0] = (*heap)[heap->len - 1];
+	if (pos >= heap->len) return -1;
+	if (compare(item, (*heap)[pos])) return -1;
+	if (equality((*heap)[pos], item)) return pos;
+	int first = heap_first_child<D>(pos);
+	for (int c = first; c < first + D; c++) {
+		int found = heap_find<D>(heap, item, equality, compare, c);
+		if (found != -1) return found;
+	}
+	return -1;
+}
+
+template <int D = 2, typename T, typename Compare>
+void heap_insert(List<T> * heap, T item, Compare compare)
+{
+	heap->push(std::move(item));
+	heap_sift_up<D>(heap->arr, heap->len - 1, compare);
+}
+
+template <int D = 2, typename T, typename Compare>
+T heap_pop(List<T> * heap, Compare compare)
+{
+	T popped = std::move((*heap)[0]);
+	T last = std::move((*heap)[heap->len - 1]);
 	heap->pop();
-	int pos = 0;
-	while (1) {
-		int left  = 2 * pos + 1;
-		int right = 2 * pos + 2;
-		int largest = pos;
-		if (left < heap->len &&
-			compare((*heap)[left], (*heap)[largest])) {
-			largest = left;
-		}
-		if (right < heap->len &&
-			compare((*heap)[right], (*heap)[largest])) {
-			largest = right;
-		}
-		if (largest != pos) {
-			SWAP(T, (*heap)[pos], (*heap)[largest]);
-			pos = largest;
-		} else {
-			break;
-		}
+	if (heap->len > 0) {
+		(*heap)[0] = std::move(last);
+		heap_sift_down<D>(heap->arr, heap->len, 0, compare);
 	}
 	return popped;
 }
 
-template <typename T>
-List<T> heap_from_array(T * arr, int len, bool(compare)(T, T))
+// Bottom-up (Floyd) construction, O(n) instead of n inserts
+template <int D = 2, typename T, typename Compare>
+List<T> heap_from_array(T * arr, int len, Compare compare)
 {
 	List<T> heap;
 	heap.alloc();
 	for (int i = 0; i < len; i++) {
-		heap_insert(&heap, arr[i], compare);
+		heap.push(arr[i]);
+	}
+	if (len > 1) {
+		for (int i = heap_parent<D>(len - 1); i >= 0; i--) {
+			heap_sift_down<D>(heap.arr, heap.len, i, compare);
+		}
 	}
 	return heap;
 }
 
-template <typename T>
-List<T> heap_as_sorted(List<T> * heap, bool(compare)(T, T))
+template <int D = 2, typename T, typename Compare>
+List<T> heap_as_sorted(List<T> * heap, Compare compare)
 {
 	List<T> sorted;
 	sorted.alloc();
 	List<T> heap_copy = heap->copy();
 	while (heap_copy.len > 0) {
-		T popped = heap_pop(&heap_copy, compare);
+		T popped = heap_pop<D>(&heap_copy, compare);
 		sorted.push(popped);
 	}
 	heap_copy.dealloc();
 	return sorted;
 }
 
+// Indexed heap: a heap that also tracks where each item sits, keyed by
+// key(item) in [0, capacity). That makes membership tests O(1) and
+// lets an item already in the heap be re-prioritised in place
+// (decrease-key) instead of being pushed a second time. Since every
+// key is in the heap at most once, the storage is fixed at capacity
+// and pushes never allocate.
+template <typename T, int D = 2>
+struct IndexedHeap {
+	T * items;
+	int len;
+	int * where; // where[key] = position in items, or -1
+	int capacity;
+};
+
+template <typename T, int D>
+void iheap_alloc(IndexedHeap<T, D> * h, int capacity)
+{
+	h->items = (T*) malloc(sizeof(T) * capacity);
+	h->len = 0;
+	h->capacity = capacity;
+	h->where = (int*) malloc(sizeof(int) * capacity);
+	for (int i = 0; i < capacity; i++) h->where[i] = -1;
+}
+
+template <typename T, int D>
+void iheap_dealloc(IndexedHeap<T, D> * h)
+{
+	free(h->items);
+	free(h->where);
+}
+
+// Empties the heap in O(len) rather than O(capacity)
+template <typename T, int D, typename Key>
+void iheap_clear(IndexedHeap<T, D> * h, Key key)
+{
+	for (int i = 0; i < h->len; i++) {
+		h->where[key(h->items[i])] = -1;
+	}
+	h->len = 0;
+}
+
+template <typename T, int D>
+bool iheap_contains(IndexedHeap<T, D> * h, int key)
+{
+	return h->where[key] != -1;
+}
+
+template <typename T, int D, typename Compare, typename Key>
+void iheap_sift_up(IndexedHeap<T, D> * h, int pos, Compare compare, Key key)
+{
+	T item = std::move(h->items[pos]);
+	while (pos != 0) {
+		int parent_pos = heap_parent<D>(pos);
+		if (!compare(item, h->items[parent_pos])) break;
+		h->items[pos] = std::move(h->items[parent_pos]);
+		h->where[key(h->items[pos])] = pos;
+		pos = parent_pos;
+	}
+	h->where[key(item)] = pos;
+	h->items[pos] = std::move(item);
+}
+
+template <typename T, int D, typename Compare, typename Key>
+void iheap_sift_down(IndexedHeap<T, D> * h, int pos, Compare compare, Key key)
+{
+	T item = std::move(h->items[pos]);
+	while (1) {
+		int first = heap_first_child<D>(pos);
+		if (first >= h->len) break;
+		int best = first;
+		int last = first + D < h->len ? first + D : h->len;
+		for (int c = first + 1; c < last; c++) {
+			if (compare(h->items[c], h->items[best])) best = c;
+		}
+		if (!compare(h->items[best], item)) break;
+		h->items[pos] = std::move(h->items[best]);
+		h->where[key(h->items[pos])] = pos;
+		pos = best;
+	}
+	h->where[key(item)] = pos;
+	h->items[pos] = std::move(item);
+}
+
+template <typename T, int D, typename Compare, typename Key>
+void iheap_insert(IndexedHeap<T, D> * h, T item, Compare compare, Key key)
+{
+	h->items[h->len++] = std::move(item);
+	iheap_sift_up(h, h->len - 1, compare, key);
+}
+
+// Replaces the item sharing item's key, which must already be in the
+// heap and must not compare better than item.
+template <typename T, int D, typename Compare, typename Key>
+void iheap_decrease(IndexedHeap<T, D> * h, T item, Compare compare, Key key)
+{
+	int pos = h->where[key(item)];
+	h->items[pos] = std::move(item);
+	iheap_sift_up(h, pos, compare, key);
+}
+
+template <typename T, int D, typename Compare, typename Key>
+T iheap_pop(IndexedHeap<T, D> * h, Compare compare, Key key)
+{
+	T popped = std::move(h->items[0]);
+	h->where[key(popped)] = -1;
+	h->len--;
+	if (h->len > 0) {
+		h->items[0] = std::move(h->items[h->len]);
+		iheap_sift_down(h, 0, compare, key);
+	}
+	return popped;
+}
+
+template <typename T, int D, typename Compare>
+bool iheap_test(IndexedHeap<T, D> * h, Compare compare)
+{
+	for (int i = 1; i < h->len; i++) {
+		int p = heap_parent<D>(i);
+		if (compare(h->items[i], h->items[p])) {
+			printf("Pos %d is larger than pos %d. "
+				"Heap test failed.\n", i, p);
+			return false;
+		}
+	}
+	return true;
+}
+
 #endif
@@ -0,0 +1,495 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hpa.h"
+#include "bitboard.h"
+#include "trace.h"
+
+static const Vector2i directions[] = {
+	{+0, -1}, // UP
+	{-1, +0}, // LEFT
+	{+0, +1}, // DOWN
+	{+1, +0}, // RIGHT
+};
+
+static const VertCompare vert_compare = VertCompare();
+static const VertKey vert_key = VertKey();
+
+// Runs shorter than this get one entrance in the middle, longer ones
+// one at each end
+#define HPA_WIDE_ENTRANCE 6
+
+struct RawNode {
+	int cluster;
+	Vector2i pos;
+	int partner;
+};
+
+static inline int local_index(Vector2i pos)
+{
+	return pos.x % ARENA_CHUNK + (pos.y % ARENA_CHUNK) * ARENA_CHUNK;
+}
+
+static inline int cluster_of(const Hpa * h, Vector2i pos)
+{
+	return pos.x / ARENA_CHUNK + (pos.y / ARENA_CHUNK) * h->clusters_x;
+}
+
+// In-cluster BFS from pos, 16x16 at a time
+static void flood_cluster(const Arena * a, Vector2i pos, int16_t * dist, uint8_t * next)
+{
+	const ArenaChunk * c = arena_chunk(a, pos.x / ARENA_CHUNK, pos.y / ARENA_CHUNK);
+	bitboard_bfs16(c->rows, ARENA_CHUNK, ARENA_CHUNK,
+		pos.x % ARENA_CHUNK, pos.y % ARENA_CHUNK, dist, next);
+}
+
+// Entrances for one border. open has bit i set where the cells at
+// place(i) on both sides are open.
+template <typename Place>
+static void add_entrances(List<RawNode> * raw, uint16_t open, int ca, int cb, Place place)
+{
+	while (open) {
+		int first = bitboard_ctz(open);
+		int last = first;
+		while (last + 1 < ARENA_CHUNK && ((open >> (last + 1)) & 1)) last++;
+		open &= (uint16_t) ~(((1u << (last - first + 1)) - 1) << first);
+		int at[2] = {(first + last) / 2, -1};
+		if (last - first + 1 >= HPA_WIDE_ENTRANCE) {
+			at[0] = first;
+			at[1] = last;
+		}
+		for (int i = 0; i < 2 && at[i] >= 0; i++) {
+			Vector2i pa, pb;
+			place(at[i], &pa, &pb);
+			RawNode na = {ca, pa, raw->len + 1};
+			RawNode nb = {cb, pb, raw->len};
+			raw->push(na);
+			raw->push(nb);
+		}
+	}
+}
+
+void make_hpa(Hpa * h)
+{
+	memset(h, 0, sizeof(Hpa));
+}
+
+void destroy_hpa(Hpa * h)
+{
+	free(h->node_pos);
+	free(h->cluster_first);
+	free(h->edge_first);
+	free(h->edges);
+	free(h->landmark_dist);
+	memset(h, 0, sizeof(Hpa));
+}
+
+// Abstract distances from node `from` to every node, -1 if unreachable
+static void dijkstra(const Hpa * h, int from, int * dist, IndexedHeap<PathVert, 4> * open)
+{
+	for (int n = 0; n < h->node_count; n++) dist[n] = -1;
+	iheap_clear(open, vert_key);
+	PathVert v;
+	v.index = from;
+	v.g = v.f = 0;
+	dist[from] = 0;
+	iheap_insert(open, v, vert_compare, vert_key);
+	while (open->len > 0) {
+		v = iheap_pop(open, vert_compare, vert_key);
+		for (int e = h->edge_first[v.index]; e < h->edge_first[v.index + 1]; e++) {
+			PathVert n;
+			n.index = h->edges[e].to;
+			n.g = n.f = v.g + h->edges[e].cost;
+			if (dist[n.index] == -1) {
+				dist[n.index] = n.g;
+				iheap_insert(open, n, vert_compare, vert_key);
+			} else if (n.g < dist[n.index] && iheap_contains(open, n.index)) {
+				dist[n.index] = n.g;
+				iheap_decrease(open, n, vert_compare, vert_key);
+			}
+		}
+	}
+}
+
+// Farthest-first: each landmark is the node farthest from all the
+// ones before it, starting from whatever's farthest from node 0. Nodes
+// the landmarks can't reach count as infinitely far, so every
+// disconnected region ends up with one of its own if there are enough
+// to go round.
+static void place_landmarks(Hpa * h)
+{
+	if (h->node_count == 0) return;
+	h->landmark_dist = (int*) malloc(sizeof(int) * HPA_LANDMARKS * h->node_count);
+	int * nearest = (int*) malloc(sizeof(int) * h->node_count);
+	int * dist = (int*) malloc(sizeof(int) * h->node_count);
+	IndexedHeap<PathVert, 4> open;
+	iheap_alloc(&open, h->node_count);
+	dijkstra(h, 0, nearest, &open);
+	for (int k = 0; k < HPA_LANDMARKS; k++) {
+		int far = 0;
+		for (int n = 1; n < h->node_count; n++) {
+			if ((unsigned) nearest[n] > (unsigned) nearest[far]) far = n;
+		}
+		dijkstra(h, far, dist, &open);
+		for (int n = 0; n < h->node_count; n++) {
+			h->landmark_dist[(size_t) n * HPA_LANDMARKS + k] = dist[n];
+			if (k == 0 || (dist[n] != -1 && (unsigned) dist[n] < (unsigned) nearest[n])) {
+				nearest[n] = dist[n];
+			}
+		}
+	}
+	iheap_dealloc(&open);
+	free(dist);
+	free(nearest);
+}
+
+void build_hpa(Hpa * h, const Arena * a)
+{
+	TRACE_SCOPE("build_hpa");
+	destroy_hpa(h);
+	h->clusters_x = a->chunks_x;
+	h->clusters_y = a->chunks_y;
+	int clusters = h->clusters_x * h->clusters_y;
+
+	List<RawNode> raw;
+	raw.alloc();
+	for (int cy = 0; cy < h->clusters_y; cy++) {
+		for (int cx = 0; cx < h->clusters_x; cx++) {
+			const ArenaChunk * c = arena_chunk(a, cx, cy);
+			int ci = cx + cy * h->clusters_x;
+			Vector2i origin = Vector2i(cx * ARENA_CHUNK, cy * ARENA_CHUNK);
+			if (cx + 1 < h->clusters_x) {
+				// Our right column against the next cluster's left one
+				const ArenaChunk * e = arena_chunk(a, cx + 1, cy);
+				uint16_t open = 0;
+				for (int r = 0; r < ARENA_CHUNK; r++) {
+					open |= ((c->rows[r] >> (ARENA_CHUNK - 1)) & e->rows[r] & 1) << r;
+				}
+				add_entrances(&raw, open, ci, ci + 1, [origin](int i, Vector2i * pa, Vector2i * pb) {
+					*pa = origin + Vector2i(ARENA_CHUNK - 1, i);
+					*pb = origin + Vector2i(ARENA_CHUNK, i);
+				});
+			}
+			if (cy + 1 < h->clusters_y) {
+				const ArenaChunk * s = arena_chunk(a, cx, cy + 1);
+				uint16_t open = c->rows[ARENA_CHUNK - 1] & s->rows[0];
+				add_entrances(&raw, open, ci, ci + h->clusters_x, [origin](int i, Vector2i * pa, Vector2i * pb) {
+					*pa = origin + Vector2i(i, ARENA_CHUNK - 1);
+					*pb = origin + Vector2i(i, ARENA_CHUNK);
+				});
+			}
+		}
+	}
+
+	// Renumber cluster by cluster (counting sort), so a cluster's
+	// nodes are one contiguous range
+	h->node_count = raw.len;
+	h->cluster_first = (int*) calloc(clusters + 1, sizeof(int));
+	for (int i = 0; i < raw.len; i++) h->cluster_first[raw[i].cluster + 1]++;
+	for (int c = 0; c < clusters; c++) h->cluster_first[c + 1] += h->cluster_first[c];
+	int * fill = (int*) malloc(sizeof(int) * clusters);
+	memcpy(fill, h->cluster_first, sizeof(int) * clusters);
+	int * renumber = (int*) malloc(sizeof(int) * raw.len);
+	for (int i = 0; i < raw.len; i++) renumber[i] = fill[raw[i].cluster]++;
+	free(fill);
+	h->node_pos = (Vector2i*) malloc(sizeof(Vector2i) * raw.len);
+	int * partner = (int*) malloc(sizeof(int) * raw.len);
+	for (int i = 0; i < raw.len; i++) {
+		h->node_pos[renumber[i]] = raw[i].pos;
+		partner[renumber[i]] = renumber[raw[i].partner];
+	}
+	free(renumber);
+	raw.dealloc();
+
+	// Edges: the hop across the border, then everything the node can
+	// walk to inside its own cluster
+	List<HpaEdge> edges;
+	edges.alloc();
+	h->edge_first = (int*) malloc(sizeof(int) * (h->node_count + 1));
+	int16_t dist[ARENA_CHUNK * ARENA_CHUNK];
+	for (int c = 0; c < clusters; c++) {
+		int first = h->cluster_first[c];
+		int last = h->cluster_first[c + 1];
+		for (int n = first; n < last; n++) {
+			h->edge_first[n] = edges.len;
+			HpaEdge across = {partner[n], 1};
+			edges.push(across);
+			flood_cluster(a, h->node_pos[n], dist, NULL);
+			for (int m = first; m < last; m++) {
+				int d = dist[local_index(h->node_pos[m])];
+				if (m == n || d < 0) continue;
+				HpaEdge inside = {m, d};
+				edges.push(inside);
+			}
+		}
+	}
+	h->edge_first[h->node_count] = edges.len;
+	h->edge_count = edges.len;
+	h->edges = (HpaEdge*) malloc(sizeof(HpaEdge) * (edges.len ? edges.len : 1));
+	memcpy(h->edges, edges.arr, sizeof(HpaEdge) * edges.len);
+	edges.dealloc();
+	free(partner);
+	place_landmarks(h);
+}
+
+void make_hpa_scratch(HpaScratch * s, const Hpa * h)
+{
+	// Plus one key each for the start and goal cells
+	int keys = h->node_count + 2;
+	s->capacity  = keys;
+	s->closed    = (uint32_t*) malloc(sizeof(uint32_t) * ((keys + 31) / 32));
+	s->came_from = (int*) malloc(sizeof(int) * keys);
+	s->g_score   = (int*) malloc(sizeof(int) * keys);
+	iheap_alloc(&s->open, keys);
+}
+
+void destroy_hpa_scratch(HpaScratch * s)
+{
+	iheap_dealloc(&s->open);
+	free(s->g_score);
+	free(s->came_from);
+	free(s->closed);
+}
+
+int hpa_first_step(
+	const Hpa * h, const Arena * a, HpaScratch * s,
+	Vector2i start, Vector2i goal, Vector2i * step)
+{
+	if (start.x == goal.x && start.y == goal.y) return 0;
+	if (!arena_open(a, start.x, start.y) || !arena_open(a, goal.x, goal.y)) return -1;
+	TRACE_SCOPE("hpa_first_step");
+	int start_cluster = cluster_of(h, start);
+	int goal_cluster = cluster_of(h, goal);
+	const int cells = ARENA_CHUNK * ARENA_CHUNK;
+	int16_t to_goal[cells];
+	uint8_t toward_goal[cells];
+	flood_cluster(a, goal, to_goal, toward_goal);
+	if (start_cluster == goal_cluster && to_goal[local_index(start)] >= 0) {
+		*step = directions[toward_goal[local_index(start)]];
+		return to_goal[local_index(start)];
+	}
+	int16_t from_start[cells];
+	flood_cluster(a, start, from_start, NULL);
+
+	// The goal is reached through one of its cluster's nodes m, which
+	// costs at least |d(k, n) - d(k, m)| + (m to goal) for any
+	// landmark k. Folding every m into one interval per landmark keeps
+	// the bound to a couple of compares: it's at least n's distance
+	// past the interval on either side.
+	int lo[HPA_LANDMARKS], hi[HPA_LANDMARKS];
+	for (int k = 0; k < HPA_LANDMARKS; k++) {
+		lo[k] = INT_MAX;
+		hi[k] = INT_MIN;
+	}
+	for (int m = h->cluster_first[goal_cluster]; m < h->cluster_first[goal_cluster + 1]; m++) {
+		int d = to_goal[local_index(h->node_pos[m])];
+		if (d < 0) continue;
+		const int * dist = h->landmark_dist + (size_t) m * HPA_LANDMARKS;
+		for (int k = 0; k < HPA_LANDMARKS; k++) {
+			if (dist[k] < 0) continue;
+			if (dist[k] + d < lo[k]) lo[k] = dist[k] + d;
+			if (dist[k] - d > hi[k]) hi[k] = dist[k] - d;
+		}
+	}
+	auto heuristic = [h, goal, &lo, &hi](int n) {
+		Vector2i pos = h->node_pos[n];
+		int best = abs(pos.x - goal.x) + abs(pos.y - goal.y);
+		const int * dist = h->landmark_dist + (size_t) n * HPA_LANDMARKS;
+		for (int k = 0; k < HPA_LANDMARKS; k++) {
+			// Landmarks that can't see both ends say nothing
+			if (dist[k] < 0 || lo[k] == INT_MAX) continue;
+			if (lo[k] - dist[k] > best) best = lo[k] - dist[k];
+			if (dist[k] - hi[k] > best) best = dist[k] - hi[k];
+		}
+		return best;
+	};
+
+	int start_key = h->node_count;
+	int goal_key = h->node_count + 1;
+	memset(s->closed, 0, sizeof(uint32_t) * ((s->capacity + 31) / 32));
+	iheap_clear(&s->open, vert_key);
+	auto relax = [s, goal_key, &heuristic](int key, int from, int g) {
+		if (s->closed[key >> 5] & (1u << (key & 31))) return;
+		PathVert v;
+		v.index = key;
+		v.g = g;
+		if (!iheap_contains(&s->open, key)) {
+			v.f = key == goal_key ? g : g + heuristic(key);
+			s->g_score[key] = g;
+			s->came_from[key] = from;
+			iheap_insert(&s->open, v, vert_compare, vert_key);
+		} else if (g < s->g_score[key]) {
+			// Same node, same heuristic
+			const PathVert & old = s->open.items[s->open.where[key]];
+			v.f = old.f - old.g + g;
+			s->g_score[key] = g;
+			s->came_from[key] = from;
+			iheap_decrease(&s->open, v, vert_compare, vert_key);
+		}
+	};
+	for (int n = h->cluster_first[start_cluster]; n < h->cluster_first[start_cluster + 1]; n++) {
+		int d = from_start[local_index(h->node_pos[n])];
+		if (d >= 0) relax(n, start_key, d);
+	}
+	int len = -1;
+	while (s->open.len > 0) {
+		PathVert v = iheap_pop(&s->open, vert_compare, vert_key);
+		if (v.index == goal_key) {
+			len = v.g;
+			break;
+		}
+		s->closed[v.index >> 5] |= 1u << (v.index & 31);
+		Vector2i pos = h->node_pos[v.index];
+		if (cluster_of(h, pos) == goal_cluster) {
+			int d = to_goal[local_index(pos)];
+			if (d >= 0) relax(goal_key, v.index, v.g + d);
+		}
+		for (int e = h->edge_first[v.index]; e < h->edge_first[v.index + 1]; e++) {
+			int to = h->edges[e].to;
+			relax(to, v.index, v.g + h->edges[e].cost);
+		}
+	}
+	if (len < 0) return -1;
+
+	// Head for the first node on the path that isn't the start cell
+	// itself. It's either in our cluster, or the neighbour across the
+	// border from an entrance we're standing on.
+	int waypoint = -1;
+	for (int n = s->came_from[goal_key]; n != start_key; n = s->came_from[n]) {
+		Vector2i pos = h->node_pos[n];
+		if (pos.x != start.x || pos.y != start.y) waypoint = n;
+	}
+	Vector2i target = waypoint >= 0 ? h->node_pos[waypoint] : goal;
+	if (cluster_of(h, target) != start_cluster) {
+		*step = target - start;
+		return len;
+	}
+	uint8_t toward[cells];
+	flood_cluster(a, target, from_start, toward);
+	*step = directions[toward[local_index(start)]];
+	return len;
+}
+
+void make_hpa_cache(HpaCache * c, int slots)
+{
+	int size = 1;
+	while (size < slots) size <<= 1;
+	c->mask = size - 1;
+	c->routes = (HpaRoute*) malloc(sizeof(HpaRoute) * size);
+	clear_hpa_cache(c);
+}
+
+void destroy_hpa_cache(HpaCache * c)
+{
+	free(c->routes);
+	c->routes = NULL;
+}
+
+void clear_hpa_cache(HpaCache * c)
+{
+	for (int i = 0; i <= c->mask; i++) c->routes[i].goal_cluster = -1;
+	c->goal = Vector2i(-1, -1);
+	c->searches = 0;
+	c->hits = 0;
+	c->misses = 0;
+}
+
+static HpaRoute * route_slot(const HpaCache * c, int region, int goal_cluster)
+{
+	uint32_t hash = (uint32_t) region * 0x9E3779B1u ^ (uint32_t) goal_cluster * 0x85EBCA77u;
+	return c->routes + ((hash ^ (hash >> 15)) & c->mask);
+}
+
+// Lowest node in n's cluster that n can walk to without leaving it
+// (its in-cluster edges list every one)
+static int region_of(const Hpa * h, int n)
+{
+	int region = n;
+	for (int e = h->edge_first[n] + 1; e < h->edge_first[n + 1]; e++) {
+		if (h->edges[e].to < region) region = h->edges[e].to;
+	}
+	return region;
+}
+
+// Walks the path the last search in s found back from the goal, and
+// files the last exit from every region it passes through under
+// goal_cluster
+static void cache_route(const Hpa * h, const HpaScratch * s, HpaCache * c, int goal_cluster)
+{
+	int start_key = h->node_count;
+	int goal_key = h->node_count + 1;
+	uint32_t search = ++c->searches;
+	int n = s->came_from[goal_key];
+	// Back out of the goal cluster to where the path last came in
+	int arrive = n;
+	while (n != start_key && cluster_of(h, h->node_pos[n]) == goal_cluster) {
+		arrive = n;
+		n = s->came_from[n];
+	}
+	int next = arrive;
+	for (; n != start_key; next = n, n = s->came_from[n]) {
+		int cluster = cluster_of(h, h->node_pos[n]);
+		if (cluster == cluster_of(h, h->node_pos[next]) || cluster == goal_cluster) continue;
+		int region = region_of(h, n);
+		HpaRoute * r = route_slot(c, region, goal_cluster);
+		// Walking backwards, so a later visit to the region has
+		// already claimed the slot
+		if (r->search == search && r->region == region && r->goal_cluster == goal_cluster) {
+			continue;
+		}
+		r->region = region;
+		r->goal_cluster = goal_cluster;
+		r->exit = n;
+		r->arrive = arrive;
+		r->remaining = s->g_score[arrive] - s->g_score[n];
+		r->search = search;
+	}
+}
+
+int hpa_first_step_cached(
+	const Hpa * h, const Arena * a, HpaScratch * s, HpaCache * c,
+	Vector2i start, Vector2i goal, Vector2i * step)
+{
+	if (start.x == goal.x && start.y == goal.y) return 0;
+	if (!arena_open(a, start.x, start.y) || !arena_open(a, goal.x, goal.y)) return -1;
+	TRACE_SCOPE("hpa_first_step_cached");
+	int start_cluster = cluster_of(h, start);
+	int goal_cluster = cluster_of(h, goal);
+	if (start_cluster == goal_cluster) {
+		return hpa_first_step(h, a, s, start, goal, step);
+	}
+	const int cells = ARENA_CHUNK * ARENA_CHUNK;
+	// Every ghost is usually after the same goal
+	if (c->goal.x != goal.x || c->goal.y != goal.y) {
+		c->goal = goal;
+		flood_cluster(a, goal, c->to_goal, NULL);
+	}
+	// The start's region is whichever one can reach its exit: try
+	// each region of the cluster that has a route (there's rarely
+	// more than one)
+	int16_t to_exit[cells];
+	uint8_t toward_exit[cells];
+	for (int n = h->cluster_first[start_cluster]; n < h->cluster_first[start_cluster + 1]; n++) {
+		if (region_of(h, n) != n) continue;
+		const HpaRoute * r = route_slot(c, n, goal_cluster);
+		if (r->region != n || r->goal_cluster != goal_cluster) continue;
+		int after = c->to_goal[local_index(h->node_pos[r->arrive])];
+		if (after < 0) continue;
+		flood_cluster(a, h->node_pos[r->exit], to_exit, toward_exit);
+		int there = to_exit[local_index(start)];
+		if (there < 0) continue;
+		if (there == 0) {
+			// On the exit: step across to its partner
+			*step = h->node_pos[h->edges[h->edge_first[r->exit]].to] - start;
+		} else {
+			*step = directions[toward_exit[local_index(start)]];
+		}
+		c->hits++;
+		return there + r->remaining + after;
+	}
+	c->misses++;
+	int len = hpa_first_step(h, a, s, start, goal, step);
+	if (len > 0) cache_route(h, s, c, goal_cluster);
+	return len;
+}
@@ -0,0 +1,127 @@
+#ifndef NES_HPA_H
+#define NES_HPA_H
+
+// Hierarchical pathfinding (HPA*) over an Arena, so a ghost on the
+// far side of a 4096x4096 map doesn't have to flood millions of cells
+// to find out which way to go.
+//
+// The arena's 16x16 chunks double as clusters. Wherever two
+// neighbouring clusters share a run of open border cells, the run gets
+// an entrance (two, at its ends, if it's 6 or more cells long): a pair
+// of abstract nodes facing each other across the border, one step
+// apart. Inside a cluster, every pair of nodes that can reach each
+// other gets an edge of their walking distance. build_hpa works all of
+// that out once per layout. A query floods only the start and goal
+// clusters, 16x16 bitboard searches, and runs A* over the abstract
+// graph in between.
+//
+// In a maze, manhattan distance badly underestimates how far things
+// are, and A* ends up wading through most of the abstract graph. So
+// build_hpa also picks a few far-apart landmark nodes and stores every
+// node's distance to each. By the triangle inequality those give a
+// much tighter lower bound on the distance left (ALT), and the search
+// heads almost straight down the path.
+//
+// Paths are near-shortest rather than shortest: they always cross
+// borders at entrances, and a start and goal sharing a cluster are
+// joined inside it when they can be.
+
+#include <stdint.h>
+#include <utility.h>
+
+#include "arena.h"
+#include "astar.h"
+
+#define HPA_LANDMARKS 8
+
+struct HpaEdge {
+	int to;
+	int cost;
+};
+
+struct Hpa {
+	int clusters_x, clusters_y;
+	int node_count;
+	Vector2i * node_pos;
+	// Nodes are numbered cluster by cluster: cluster c owns nodes
+	// cluster_first[c] up to cluster_first[c + 1]
+	int * cluster_first;
+	// Edges of node n are edges[edge_first[n]] up to edge_first[n + 1]
+	int * edge_first;
+	HpaEdge * edges;
+	int edge_count;
+	// landmark_dist[n * HPA_LANDMARKS + k] is the abstract distance
+	// from landmark k to node n, or -1 if they aren't connected. A
+	// node's distances share a cache line.
+	int * landmark_dist;
+};
+
+void make_hpa(Hpa * h);
+void destroy_hpa(Hpa * h);
+// Rebuilds the abstract graph for the arena's current layout
+void build_hpa(Hpa * h, const Arena * a);
+
+// Per-query search state, sized for one Hpa. Queries through it never
+// touch the allocator.
+struct HpaScratch {
+	int capacity;
+	uint32_t * closed;
+	int * came_from;
+	int * g_score;
+	IndexedHeap<PathVert, 4> open;
+};
+
+void make_hpa_scratch(HpaScratch * s, const Hpa * h);
+void destroy_hpa_scratch(HpaScratch * s);
+
+// Length of the path found from start to goal, 0 if they're the same
+// cell or -1 if goal can't be reached. On success step gets the first
+// move, one of the four unit directions.
+int hpa_first_step(
+	const Hpa * h, const Arena * a, HpaScratch * s,
+	Vector2i start, Vector2i goal, Vector2i * step);
+
+// Where paths toward a goal cluster leave each cluster they cross.
+// Every ghost chasing the same player heads for the same cluster, and
+// after one search has crossed a cluster the rest only need to know
+// which of its nodes the path left by. A cluster split by walls can
+// be crossed more than once through different parts, so routes are
+// filed per region: the cells of a cluster that can reach each other
+// inside it, named by the lowest node among them. Entries go in a
+// fixed-size table, newest path wins a slot.
+struct HpaRoute {
+	int region;
+	int goal_cluster; // -1 for an empty slot
+	int exit;         // node the path crosses out of cluster at
+	int arrive;       // node it first enters goal_cluster at
+	int remaining;    // abstract distance from exit to arrive
+	uint32_t search;  // which search wrote it
+};
+
+struct HpaCache {
+	int mask; // slots - 1
+	HpaRoute * routes;
+	// In-cluster distances to the last goal asked for
+	Vector2i goal;
+	int16_t to_goal[ARENA_CHUNK * ARENA_CHUNK];
+	uint32_t searches;
+	int hits, misses;
+};
+
+// slots is rounded up to a power of two. A cache belongs to one
+// layout: clear it whenever the Hpa is rebuilt.
+void make_hpa_cache(HpaCache * c, int slots);
+void destroy_hpa_cache(HpaCache * c);
+void clear_hpa_cache(HpaCache * c);
+
+// hpa_first_step through the cache. Outside the goal's cluster, a
+// start whose region has a route costs a 16x16 flood instead of a
+// search, and gets the length of the route it's following.
+// Otherwise it searches and caches every region the path crosses. Following the steps it gives always reaches the goal:
+// within one search's entries the path only moves forward, and newer
+// searches overwrite older ones.
+int hpa_first_step_cached(
+	const Hpa * h, const Arena * a, HpaScratch * s, HpaCache * c,
+	Vector2i start, Vector2i goal, Vector2i * step);
+
+#endif
@@ -0,0 +1,87 @@
+#include <limits.h>
+#include <string.h>
+
+#include "layer.h"
+
+void make_draw_layer(DrawLayer * layer)
+{
+	// Neither stamp can come out as this (the HUD's is -1 with no
+	// crystal yet), so the first bake always happens
+	layer->stamp = INT_MIN;
+	memset(layer->open_rows, 0, sizeof(layer->open_rows));
+	layer->builds = 0;
+	layer->cmds.alloc();
+}
+
+void destroy_draw_layer(DrawLayer * layer)
+{
+	layer->cmds.dealloc();
+}
+
+static void layer_push(DrawLayer * layer, Vector2i pos, Vector2i tex_pos, Vector2i tex_dim, Vector2f scale)
+{
+	DrawCmd cmd;
+	cmd.pos = pos;
+	cmd.tex_pos = tex_pos;
+	cmd.tex_dim = tex_dim;
+	cmd.scale = scale;
+	layer->cmds.push(cmd);
+}
+
+DrawCmd crystal_cmd(const Level * level, const Player * player)
+{
+	DrawCmd cmd;
+	cmd.pos = Vector2i(level->crystal_pos.x * 16, level->crystal_pos.y * 16);
+	cmd.tex_pos = Vector2i((player->power_max + 1) * 16 + 48, 0);
+	cmd.tex_dim = Vector2i(16, 16);
+	cmd.scale = Vector2f(1, 1);
+	return cmd;
+}
+
+bool ghost_cmd(const Ghosts * ghosts, int i, DrawCmd * cmd)
+{
+	if (!ghosts->visible[i]) return false;
+	cmd->pos = Vector2i(ghosts->pos_x[i], ghosts->pos_y[i]);
+	cmd->tex_pos = ghosts->tex_pos[i];
+	cmd->tex_dim = Vector2i(16, 16);
+	cmd->scale = Vector2f(1, 1);
+	return true;
+}
+
+bool bake_wall_layer(DrawLayer * layer, const Level * level)
+{
+	if (layer->builds &&
+		!memcmp(layer->open_rows, level->open_rows, sizeof(layer->open_rows))) {
+		return false;
+	}
+	memcpy(layer->open_rows, level->open_rows, sizeof(layer->open_rows));
+	layer->builds++;
+	layer->cmds.len = 0;
+	for (int y = 0; y < Level::play_h; y++) {
+		for (int x = 0; x < Level::play_w; x++) {
+			if (!level->grid[to_index(x, y)]) continue;
+			layer_push(layer, Vector2i(x * 16, y * 16),
+				Vector2i(0, 5 * 16), Vector2i(16, 16), Vector2f(1, 1));
+		}
+	}
+	return true;
+}
+
+bool bake_hud_layer(DrawLayer * layer, const Player * player, Vector2i res)
+{
+	int stamp = player->power_level + player->power_max * 256;
+	if (layer->stamp == stamp) return false;
+	layer->stamp = stamp;
+	layer->builds++;
+	layer->cmds.len = 0;
+	for (int i = 0; i < 8; i++) {
+		Vector2i tex = i == player->power_level ? Vector2i(0, 48) : Vector2i(0, 16);
+		layer_push(layer, Vector2i(i * 32, res.y - 32), tex, Vector2i(32, 32), Vector2f(1, 1));
+	}
+	for (int i = 0; i < player->power_max + 1; i++) {
+		layer_push(layer, Vector2i(i * 32 + 8, res.y - 24),
+			Vector2i(i * 16 + 48, 0), Vector2i(16, 16), Vector2f(1, 1));
+	}
+	layer_push(layer, Vector2i(0, res.y - 48), Vector2i(0, 0), Vector2i(16, 16), Vector2f(16, 1));
+	return true;
+}
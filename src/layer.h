@@ -0,0 +1,50 @@
+#ifndef NES_LAYER_H
+#define NES_LAYER_H
+
+// Baked draw layers. Anything that only changes now and then (the
+// walls, the HUD) gets turned into a flat list of sprite commands when
+// it changes, and the frame loop just replays the list. A layer
+// remembers a stamp of whatever it was built from, so rebuilding is a
+// single compare when nothing moved.
+//
+// Replaying saves the rebuild, not the draw calls: through Render each
+// command is still its own call. SoftRender draws the wall layer into
+// a base buffer once per maze, which is how main.cc --soft gets the
+// whole frame onto the screen in a single texture copy.
+
+#include <utility.h>
+
+#include "sim.h"
+
+struct DrawCmd {
+	Vector2i pos;
+	Vector2i tex_pos;
+	Vector2i tex_dim;
+	Vector2f scale;
+};
+
+struct DrawLayer {
+	// What the layer was last built from. The HUD's power levels fit
+	// in stamp; the walls keep the layout itself, since two branches of
+	// one game can reach the same generation with different mazes.
+	int stamp;
+	uint16_t open_rows[16];
+	// Bumped on every rebuild, so anything drawn from the layer can
+	// tell when it's stale
+	int builds;
+	List<DrawCmd> cmds;
+};
+
+void make_draw_layer(DrawLayer * layer);
+void destroy_draw_layer(DrawLayer * layer);
+
+// The crystal's colour follows the next power the player will unlock
+DrawCmd crystal_cmd(const Level * level, const Player * player);
+// False if ghost i is flashed off this frame
+bool ghost_cmd(const Ghosts * ghosts, int i, DrawCmd * cmd);
+
+// Each returns true if the layer was rebuilt
+bool bake_wall_layer(DrawLayer * layer, const Level * level);
+bool bake_hud_layer(DrawLayer * layer, const Player * player, Vector2i res);
+
+#endif
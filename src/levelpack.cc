@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "levelpack.h"
+#include "trace.h"
+
+bool open_level_pack(LevelPack * pack, const char * path)
+{
+	memset(pack, 0, sizeof(LevelPack));
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+	pack->data = (const uint8_t*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	pack->size = (size_t) size.QuadPart;
+	pack->mapping = mapping;
+	pack->file = file;
+	if (!pack->data) {
+		close_level_pack(pack);
+		return false;
+	}
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	fstat(fd, &st);
+	pack->size = st.st_size;
+	void * data = mmap(NULL, pack->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return false;
+	// Levels get picked at random
+	madvise(data, pack->size, MADV_RANDOM);
+	pack->data = (const uint8_t*) data;
+#endif
+	if (pack->size < sizeof(PackHeader)) {
+		close_level_pack(pack);
+		return false;
+	}
+	memcpy(&pack->header, pack->data, sizeof(PackHeader));
+	const PackHeader * h = &pack->header;
+	if (h->magic != PACK_MAGIC || h->version != PACK_VERSION ||
+		h->top_left_count > h->level_count ||
+		h->level_count > (pack->size - sizeof(PackHeader)) / sizeof(uint32_t)) {
+		close_level_pack(pack);
+		return false;
+	}
+	pack->index = (const uint32_t*) (pack->data + sizeof(PackHeader));
+	return true;
+}
+
+void close_level_pack(LevelPack * pack)
+{
+#ifdef _WIN32
+	if (pack->data) UnmapViewOfFile(pack->data);
+	if (pack->mapping) CloseHandle((HANDLE) pack->mapping);
+	if (pack->file) CloseHandle((HANDLE) pack->file);
+#else
+	if (pack->data) munmap((void*) pack->data, pack->size);
+#endif
+	memset(pack, 0, sizeof(LevelPack));
+}
+
+static size_t hops_bytes(int open_count)
+{
+	return (size_t) open_count * ((open_count + 3) / 4) + (size_t) open_count * open_count;
+}
+
+static bool pack_cell_open(const PackLevel * l, int x, int y)
+{
+	return x < Level::play_w && y < Level::play_h && ((l->open_rows[y] >> x) & 1);
+}
+
+const PackLevel * pack_level(const LevelPack * pack, int i)
+{
+	if (i < 0 || (uint32_t) i >= pack->header.level_count) return NULL;
+	uint32_t offset = pack->index[i];
+	if (offset % 4 || offset > pack->size || pack->size - offset < sizeof(PackLevel)) {
+		return NULL;
+	}
+	const PackLevel * l = (const PackLevel*) (pack->data + offset);
+	// Everything the sim indexes with has to land on the play field
+	for (int y = Level::play_h; y < 16; y++) {
+		if (l->open_rows[y]) return NULL;
+	}
+	if (!pack_cell_open(l, l->crystal_x, l->crystal_y) || l->spawn_count > PACK_SPAWNS) {
+		return NULL;
+	}
+	for (int s = 0; s < l->spawn_count; s++) {
+		if (!pack_cell_open(l, l->spawns[s].x, l->spawns[s].y)) return NULL;
+	}
+	// load_pack_level sizes the hops copy from the grid, so the count
+	// the blob was checked against has to agree with it
+	int open = 0;
+	for (int y = 0; y < Level::play_h; y++) open += __builtin_popcount(l->open_rows[y]);
+	if (open != l->open_count) return NULL;
+	if (l->hops_offset &&
+		(l->hops_offset > pack->size ||
+		pack->size - l->hops_offset < hops_bytes(l->open_count))) {
+		return NULL;
+	}
+	return l;
+}
+
+void load_pack_level(Sim * sim, const LevelPack * pack, const PackLevel * pl)
+{
+	TRACE_SCOPE("load_pack_level");
+	Level * level = &sim->level;
+	memcpy(level->open_rows, pl->open_rows, sizeof(level->open_rows));
+	for (int y = 0; y < Level::play_h; y++) {
+		for (int x = 0; x < Level::play_w; x++) {
+			level->grid[to_index(x, y)] = !((pl->open_rows[y] >> x) & 1);
+		}
+	}
+	level->crystal_pos = Vector2i(pl->crystal_x, pl->crystal_y);
+	// Level::top_left is the corner the *next* level starts in
+	level->top_left = !pl->top_left;
+	level->generation++;
+	NextHopTable * hops = sim->hops;
+	if (!hops) return;
+	if (pl->hops_offset) {
+		const uint8_t * dirs = pack->data + pl->hops_offset;
+		const uint8_t * dist = dirs + (size_t) pl->open_count * ((pl->open_count + 3) / 4);
+		load_next_hop_table(hops, level->grid, Level::play_w, Level::play_h, dirs, dist);
+	} else {
+		build_next_hop_table(hops, level->grid, Level::play_w, Level::play_h);
+	}
+}
+
+static void hash_bytes(uint32_t * h, const void * data, size_t len)
+{
+	const uint8_t * p = (const uint8_t*) data;
+	for (size_t i = 0; i < len; i++) {
+		*h ^= p[i];
+		*h *= 16777619u;
+	}
+}
+
+static void write_hashed(FILE * file, uint32_t * h, const void * data, size_t len)
+{
+	fwrite(data, 1, len, file);
+	hash_bytes(h, data, len);
+}
+
+// The same rule generate_ghosts plays by: an empty cell at least
+// MINIMUM_GHOST_DISTANCE pixels from where the player starts
+static void pick_spawns(PackLevel * pl, const Level * level, Vector2i start, Rng * rng)
+{
+	pl->spawn_count = PACK_SPAWNS;
+	for (int i = 0; i < PACK_SPAWNS; i++) {
+		Vector2i spot;
+		int dx, dy;
+		do {
+			spot.x = rng_range(rng, Level::play_w);
+			spot.y = rng_range(rng, Level::play_h);
+			dx = (spot.x - start.x) * 16;
+			dy = (spot.y - start.y) * 16;
+		} while (
+			level->grid[to_index(spot)] ||
+			MINIMUM_GHOST_DISTANCE * MINIMUM_GHOST_DISTANCE > dx * dx + dy * dy);
+		pl->spawns[i].x = (uint8_t) spot.x;
+		pl->spawns[i].y = (uint8_t) spot.y;
+		pl->spawns[i].speed = (uint8_t) rng_range(rng, 100);
+		pl->spawns[i].pad = 0;
+	}
+}
+
+bool write_level_pack(const char * path, int count, uint32_t seed, uint32_t flags)
+{
+	if (count <= 0) return false;
+
+	PackHeader header;
+	header.magic = PACK_MAGIC;
+	header.version = PACK_VERSION;
+	header.level_count = count;
+	header.top_left_count = (count + 1) / 2;
+	header.flags = flags;
+	header.checksum = 2166136261u;
+
+	Rng rng;
+	rng_seed(&rng, seed);
+	PackLevel * levels = (PackLevel*) calloc(count, sizeof(PackLevel));
+	// Offsets are stored as uint32, so anything past 4 GB is refused
+	uint64_t level_start = sizeof(PackHeader) + sizeof(uint32_t) * (uint64_t) count;
+	uint64_t hops_offset = level_start + sizeof(PackLevel) * (uint64_t) count;
+	for (int i = 0; i < count; i++) {
+		PackLevel * pl = levels + i;
+		Level level;
+		level.top_left = (uint32_t) i < header.top_left_count;
+		Vector2i start = level.top_left ?
+			Vector2i(1, 1) : Vector2i(Level::play_w - 2, Level::play_h - 2);
+		pl->top_left = level.top_left;
+		generate_level(&level, &rng);
+		memcpy(pl->open_rows, level.open_rows, sizeof(pl->open_rows));
+		pl->crystal_x = (uint8_t) level.crystal_pos.x;
+		pl->crystal_y = (uint8_t) level.crystal_pos.y;
+		pick_spawns(pl, &level, start, &rng);
+		int open = 0;
+		for (int y = 0; y < Level::play_h; y++) open += __builtin_popcount(level.open_rows[y]);
+		pl->open_count = (uint16_t) open;
+		if (flags & PACK_HOPS) {
+			pl->hops_offset = (uint32_t) hops_offset;
+			hops_offset += hops_bytes(open);
+		}
+	}
+	FILE * file = hops_offset > UINT32_MAX ? NULL : fopen(path, "wb");
+	if (!file) {
+		free(levels);
+		return false;
+	}
+
+	// Placeholder, patched once the checksum is known
+	fwrite(&header, sizeof(PackHeader), 1, file);
+	for (int i = 0; i < count; i++) {
+		uint32_t offset = (uint32_t) (level_start + sizeof(PackLevel) * i);
+		write_hashed(file, &header.checksum, &offset, sizeof(offset));
+	}
+	write_hashed(file, &header.checksum, levels, sizeof(PackLevel) * count);
+	if (flags & PACK_HOPS) {
+		NextHopTable hops;
+		make_next_hop_table(&hops, 1 << 20);
+		int grid[Level::play_w * Level::play_h];
+		for (int i = 0; i < count; i++) {
+			const PackLevel * pl = levels + i;
+			for (int c = 0; c < Level::play_w * Level::play_h; c++) {
+				grid[c] = !((pl->open_rows[c / Level::play_w] >> (c % Level::play_w)) & 1);
+			}
+			build_next_hop_table(&hops, grid, Level::play_w, Level::play_h);
+			write_hashed(file, &header.checksum, hops.dirs, (size_t) hops.cell_count * hops.row_bytes);
+			write_hashed(file, &header.checksum, hops.dist, (size_t) hops.cell_count * hops.cell_count);
+		}
+		destroy_next_hop_table(&hops);
+	}
+	free(levels);
+
+	fseek(file, 0, SEEK_SET);
+	fwrite(&header, sizeof(PackHeader), 1, file);
+	bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
@@ -0,0 +1,99 @@
+#ifndef NES_LEVELPACK_H
+#define NES_LEVELPACK_H
+
+// Pre-generated levels. bin/levelpack writes a batch of them to a file
+// offline; the game and the headless tools map that file and take each
+// level straight out of it, so a level switch doesn't generate a maze,
+// rejection-sample ghost spawns or run a BFS per cell. Benchmarks that
+// run off a pack also all play on the same fixed set of levels.
+//
+// File layout, all little-endian:
+//   PackHeader
+//   index: uint32_t file offset of each PackLevel, level_count of them
+//   PackLevels, then (with PACK_HOPS) their next-hop rows
+// Levels starting in the top-left corner come first, so picking one
+// for a given corner is picking an index in a range.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sim.h"
+
+#define PACK_MAGIC   0x5053454E // "NESP"
+#define PACK_VERSION 1
+
+// At least the most ghosts a level ever spawns
+#define PACK_SPAWNS 5
+
+enum PackFlag {
+	// Every level carries its all-pairs next-hop rows, for sims that
+	// route ghosts off a NextHopTable
+	PACK_HOPS = 1 << 0,
+};
+
+struct PackHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t level_count;
+	// Levels [0, top_left_count) start top-left, the rest bottom-right
+	uint32_t top_left_count;
+	uint32_t flags; // PackFlag
+	// FNV-1a over everything after the header. Replays made on a pack
+	// store it, so they aren't played back on a different one.
+	uint32_t checksum;
+};
+
+// A ghost spawn far enough from the level's start. speed is the
+// 0..99 roll generate_ghosts would have made for the ghost's move_div.
+struct PackSpawn {
+	uint8_t x, y;
+	uint8_t speed;
+	uint8_t pad;
+};
+
+// One cache line per level
+struct PackLevel {
+	uint16_t open_rows[16]; // as Level::open_rows
+	uint8_t crystal_x, crystal_y;
+	uint8_t top_left; // start corner
+	uint8_t spawn_count;
+	PackSpawn spawns[PACK_SPAWNS];
+	uint16_t open_count;
+	uint16_t pad;
+	// File offset of the next-hop dirs rows, open_count *
+	// ((open_count + 3) / 4) bytes, followed by the open_count *
+	// open_count dist rows. 0 without PACK_HOPS.
+	uint32_t hops_offset;
+};
+
+static_assert(sizeof(PackLevel) == 64, "PackLevel should fill a cache line");
+
+struct LevelPack {
+	PackHeader header;
+	const uint8_t * data;
+	size_t size;
+	const uint32_t * index;
+	void * mapping; // platform handles
+	void * file;
+};
+
+// Maps the file; only the header and the index's bounds are checked
+bool open_level_pack(LevelPack * pack, const char * path);
+void close_level_pack(LevelPack * pack);
+
+// Level i, pointing into the mapping, or NULL if its entry is out of
+// bounds or malformed: open cells outside the play field, a crystal or
+// spawn off an open cell, or an open_count that doesn't match open_rows
+const PackLevel * pack_level(const LevelPack * pack, int i);
+
+// Generates count levels from seed (half starting in each corner) and
+// writes them to path. flags is PackFlag. Fails without touching path
+// if the pack would run past the 4 GB its uint32 offsets can address.
+bool write_level_pack(const char * path, int count, uint32_t seed, uint32_t flags);
+
+// Puts a level of the pack (from pack_level) in place of sim's
+// current one, and its next-hop rows into sim->hops if both are there.
+// Doesn't touch the ghosts.
+void load_pack_level(Sim * sim, const LevelPack * pack, const PackLevel * pl);
+
+#endif
@@ -0,0 +1,136 @@
+#include "loader.h"
+
+void make_loader(Loader * loader)
+{
+	loader->origin = std::chrono::steady_clock::now();
+	loader->job_count = 0;
+	loader->started_count = 0;
+	loader->next_job = 0;
+	loader->worker_count = 0;
+	loader->workers = NULL;
+	loader->first_frame = -1;
+	loader->reported = false;
+}
+
+void destroy_loader(Loader * loader)
+{
+	for (int i = 0; i < loader->worker_count; i++) {
+		loader->workers[i].join();
+	}
+	delete[] loader->workers;
+	loader->workers = NULL;
+	loader->worker_count = 0;
+}
+
+int64_t loader_now(const Loader * loader)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - loader->origin).count();
+}
+
+static LoadJob * push_job(Loader * loader, const char * name)
+{
+	if (loader->job_count == LOADER_MAX_JOBS) return NULL;
+	LoadJob * job = loader->jobs + loader->job_count++;
+	job->name = name;
+	job->func = NULL;
+	job->data = NULL;
+	job->note = NULL;
+	job->on_main = false;
+	job->start = job->end = 0;
+	job->done = false;
+	job->polled = false;
+	return job;
+}
+
+int loader_add(Loader * loader, const char * name, LoadFunc func, void * data)
+{
+	LoadJob * job = push_job(loader, name);
+	if (!job) return -1;
+	job->func = func;
+	job->data = data;
+	return (int) (job - loader->jobs);
+}
+
+static void worker_loop(Loader * loader)
+{
+	for (;;) {
+		int i = loader->next_job++;
+		if (i >= loader->started_count) return;
+		LoadJob * job = loader->jobs + i;
+		if (job->on_main) continue;
+		job->start = loader_now(loader);
+		job->note = job->func(job->data);
+		job->end = loader_now(loader);
+		job->done.store(true, std::memory_order_release);
+	}
+}
+
+void loader_start(Loader * loader, int worker_count)
+{
+	loader->started_count = loader->job_count;
+	if (worker_count <= 0) {
+		worker_count = loader->job_count;
+		int cores = (int) std::thread::hardware_concurrency();
+		if (cores > 0 && worker_count > cores) worker_count = cores;
+	}
+	loader->worker_count = worker_count;
+	loader->workers = new std::thread[worker_count];
+	for (int i = 0; i < worker_count; i++) {
+		loader->workers[i] = std::thread(worker_loop, loader);
+	}
+}
+
+int loader_poll(Loader * loader)
+{
+	for (int i = 0; i < loader->job_count; i++) {
+		LoadJob * job = loader->jobs + i;
+		if (job->polled || job->on_main) continue;
+		if (job->done.load(std::memory_order_acquire)) {
+			job->polled = true;
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool loader_done(const Loader * loader)
+{
+	for (int i = 0; i < loader->job_count; i++) {
+		const LoadJob * job = loader->jobs + i;
+		if (!job->on_main && !job->done.load(std::memory_order_acquire)) return false;
+	}
+	return true;
+}
+
+void loader_time(Loader * loader, const char * name, int64_t start)
+{
+	LoadJob * job = push_job(loader, name);
+	if (!job) return;
+	job->on_main = true;
+	job->start = start;
+	job->end = loader_now(loader);
+	job->done = true;
+}
+
+void loader_first_frame(Loader * loader)
+{
+	if (loader->first_frame < 0) loader->first_frame = loader_now(loader);
+}
+
+void loader_report(const Loader * loader, FILE * out)
+{
+	int64_t all = 0;
+	for (int i = 0; i < loader->job_count; i++) {
+		if (loader->jobs[i].end > all) all = loader->jobs[i].end;
+	}
+	fprintf(out, "startup: first frame at %.1f ms, everything loaded at %.1f ms\n",
+		loader->first_frame / 1e6, all / 1e6);
+	for (int i = 0; i < loader->job_count; i++) {
+		const LoadJob * job = loader->jobs + i;
+		fprintf(out, "  %-24s %-6s %7.1f - %7.1f ms  %7.1f ms  %s\n",
+			job->name, job->on_main ? "main" : "worker",
+			job->start / 1e6, job->end / 1e6, (job->end - job->start) / 1e6,
+			job->note ? job->note : "");
+	}
+}
@@ -0,0 +1,69 @@
+#ifndef NES_LOADER_H
+#define NES_LOADER_H
+
+// Startup loading off the main thread. Jobs are queued up front, then
+// run in parallel on worker threads while the main thread gets on with
+// opening the window and drawing frames; it picks finished jobs up
+// with loader_poll whenever it likes. Everything is timed against
+// make_loader, so launch can print where the startup time went.
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <thread>
+
+#define LOADER_MAX_JOBS 16
+
+// Runs on a worker. Returns a short note for the startup report (like
+// where the data came from), or NULL.
+typedef const char * (*LoadFunc)(void * data);
+
+struct LoadJob {
+	const char * name;
+	LoadFunc func;
+	void * data;
+	const char * note;
+	bool on_main; // a main-thread step from loader_time, not a job
+	int64_t start, end; // ns since make_loader
+	std::atomic<bool> done;
+	bool polled;
+};
+
+struct Loader {
+	std::chrono::steady_clock::time_point origin;
+	int job_count;
+	LoadJob jobs[LOADER_MAX_JOBS];
+	// Jobs queued when the workers started; main-thread steps added
+	// after that are past the end of what they look at
+	int started_count;
+	std::atomic<int> next_job;
+	int worker_count;
+	std::thread * workers;
+	int64_t first_frame; // ns, -1 until loader_first_frame
+	bool reported;
+};
+
+void make_loader(Loader * loader);
+// Waits for any jobs still running
+void destroy_loader(Loader * loader);
+int64_t loader_now(const Loader * loader);
+
+// Queues a job, before loader_start. Returns its index, or -1 if
+// there's no room.
+int loader_add(Loader * loader, const char * name, LoadFunc func, void * data);
+// Starts working through the queue. worker_count 0 uses a thread per
+// job, up to the core count.
+void loader_start(Loader * loader, int worker_count = 0);
+// Index of a job that finished since the last call (its results are
+// safe to read), or -1
+int loader_poll(Loader * loader);
+bool loader_done(const Loader * loader);
+
+// Puts a step the main thread did itself, from start until now, in
+// the report
+void loader_time(Loader * loader, const char * name, int64_t start);
+void loader_first_frame(Loader * loader);
+void loader_report(const Loader * loader, FILE * out);
+
+#endif
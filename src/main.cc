@@ -1,6 +1,9 @@
 #include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <utility.h>
 
@@ -10,326 +13,211 @@
 
 #include <render.h>
 
-#include "astar.h"
-#include "heap.h"
-
-#define SQR(x) ((x) * (x))
-
-Vector2i directions[] = {
-	{+0, -1}, // UP
-	{-1, +0}, // LEFT
-	{+0, +1}, // DOWN
-	{+1, +0}, // RIGHT
-};
+#include "sim.h"
+#include "audio.h"
+#include "levelpack.h"
+#include "replay.h"
+#include "layer.h"
+#include "soft_render.h"
+#include "loader.h"
+#include "pacer.h"
+#include "trace.h"
 
 struct Sounds {
 	Mix_Music * bgm;
-	Mix_Chunk * player_death;
-	Mix_Chunk * ghost_death;
-	Mix_Chunk * crystal_grab;
-	Mix_Chunk * won_game;
+	// Filled in by poll_sounds as they load, read on the audio thread
+	std::atomic<Mix_Chunk*> chunks[SOUND_EVENT_COUNT];
+	// pacer_now() at which the last chunk started will have finished
+	std::atomic<int64_t> busy_until;
+	int bytes_per_second;
 };
 
 Sounds sounds;
 
-void init_sounds()
-{
-	char * base = SDL_GetBasePath();
-	auto load_song = [base](Mix_Music ** chunk, char * rel) {
-		StringBuilder builder;
-		builder.alloc();
-		builder.append(base);
-		builder.append(rel);
-		printf("'%s'\n", builder.str());
-		*chunk = Mix_LoadMUS(builder.str());
-		builder.dealloc();
-	};
-	auto load = [base](Mix_Chunk ** chunk, char * rel) {
-		StringBuilder builder;
-		builder.alloc();
-		builder.append(base);
-		builder.append(rel);
-		printf("'%s'\n", builder.str());
-		*chunk = Mix_LoadWAV(builder.str());
-		builder.dealloc();
-	};
-	load_song(&sounds.bgm,      "..\\sound\\song.ogg");
-	load(&sounds.player_death,  "..\\sound\\lose.ogg");
-	load(&sounds.ghost_death,   "..\\sound\\yelp.ogg");
-	load(&sounds.crystal_grab,  "..\\sound\\ring.ogg");
-	load(&sounds.won_game,  "..\\sound\\win.ogg");
-}
-
-struct Texture {
-	Vector2i pos;
-	Vector2i dim;
-	Vector2f scale;
-};
-
-enum EntityType {
-	ENTITY,
-	PLAYER,
-	GHOST,
-};
-
-struct Entity {
-	Vector2i pos;
-	Vector2i grid_pos;
-	Vector2i target_pos;
-	float move_t;
-	float move_div;
-	bool moving;
-	bool visible = true;
-	Texture  tex;
-	EntityType type;
-};
-
-#define PLAYER_DEATH_TIMER_RESET 1.0
-#define PLAYER_FLASH_TIMER_RESET 0.1
-struct Player : Entity {
-	int power_max;
-	int power_level;
-	Vector2i direction;
-	Vector2i queued_direction;
-	float death_timer;
-	float flash_timer;
-};
-
-enum GhostState {
-	GHOST_ALIVE,
-	GHOST_DEAD,
-};
-
-#define GHOST_DEATH_TIMER_RESET 1.0
-#define GHOST_FLASH_TIMER_RESET 0.1
-struct Ghost : Entity {
-	int power_type;
-	Vector2i direction;
-	GhostState state;
-	float death_timer;
-	float flash_timer;
-	int id;
-};
-
-struct Window {
-	Vector2i res;
-	SDL_Window * sdl;
-	uint32_t last_time;
-	float delta_time = 0.0167;
-};
-
-static Window window;
-
-struct Level {
-	static const int play_w = 16;
-	static const int play_h = 13;
-	bool top_left = true;
-	int grid[play_w * play_h];
-	Vector2i crystal_pos;
-	List<Entity> walls;
-};
-
-enum GameState {
-	GAME_PLAYING,
-	GAME_LOSS,
-	GAME_WIN,
-};
-
-struct Game {
-	const Level  * level;
-	const Player * player;
-	const List<Ghost> * ghosts;
-	const GameState * game_state;
+// Decoded sounds, exactly as the mixer holds them (already converted
+// to the device format), keyed on the source file so an edited OGG
+// gets decoded again.
+#define PCM_CACHE_MAGIC   0x4350454E // "NEPC"
+#define PCM_CACHE_VERSION 1
+struct PcmCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	int32_t freq;
+	uint16_t format;
+	uint16_t channels;
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint32_t bytes;
 };
 
-static Game game;
-
-inline int to_index(Vector2i pos, int w = Level::play_w)
-{
-	return pos.x + pos.y * w;
-}
-
-inline int to_index(int x, int y, int w = Level::play_w)
-{
-	return x + y * w;
-}
-
-void make_entity(Entity * e, Vector2i pos, Texture tex)
+static bool make_pcm_cache_header(PcmCacheHeader * h, const char * source)
 {
-	e->pos = Vector2i(pos.x * 16, pos.y * 16);
-	e->grid_pos = pos;
-	e->target_pos = pos;
-	e->move_t = 0;
-	e->move_div = 0.3;
-	e->tex = tex;
-	e->moving = false;
-	e->type = ENTITY;
+	struct stat st;
+	int freq, channels;
+	Uint16 format;
+	if (stat(source, &st) != 0 || !Mix_QuerySpec(&freq, &format, &channels)) return false;
+	memset(h, 0, sizeof(PcmCacheHeader));
+	h->magic = PCM_CACHE_MAGIC;
+	h->version = PCM_CACHE_VERSION;
+	h->freq = freq;
+	h->format = format;
+	h->channels = (uint16_t) channels;
+	h->source_size = st.st_size;
+	h->source_mtime = st.st_mtime;
+	return true;
 }
 
-void move_entity(Entity * e, Vector2i target)
+static Mix_Chunk * read_pcm_cache(const char * path, const PcmCacheHeader * want)
 {
-	if (target.x == e->grid_pos.x && target.y == e->grid_pos.y) return;
-	e->moving = true;
-	e->move_t += window.delta_time;
-	float t = e->move_t / e->move_div;
-	e->pos.x = (e->grid_pos.x * 16) + t * ((target.x - e->grid_pos.x) * 16);
-	e->pos.y = (e->grid_pos.y * 16) + t * ((target.y - e->grid_pos.y) * 16);
-	if (t >= 1) {
-		e->move_t = 0;
-		e->moving = false;
-		e->grid_pos = target;
-		e->pos.x = e->grid_pos.x * 16;
-		e->pos.y = e->grid_pos.y * 16;
+	FILE * file = fopen(path, "rb");
+	if (!file) return NULL;
+	PcmCacheHeader h;
+	Mix_Chunk * chunk = NULL;
+	if (fread(&h, sizeof(h), 1, file) == 1 &&
+		memcmp(&h, want, offsetof(PcmCacheHeader, bytes)) == 0) {
+		Uint8 * pcm = (Uint8*) SDL_malloc(h.bytes);
+		if (pcm && fread(pcm, 1, h.bytes, file) == h.bytes) {
+			chunk = Mix_QuickLoad_RAW(pcm, h.bytes);
+		}
+		if (chunk) {
+			// Hand the buffer over, so Mix_FreeChunk frees it
+			chunk->allocated = 1;
+		} else {
+			SDL_free(pcm);
+		}
 	}
+	fclose(file);
+	return chunk;
 }
 
-void draw_entity(Entity * e)
+static void write_pcm_cache(const char * path, PcmCacheHeader h, const Mix_Chunk * chunk)
 {
-	if (!e->visible) return;
-	Render::render(e->pos, e->tex.pos, e->tex.dim, e->tex.scale);
+	FILE * file = fopen(path, "wb");
+	if (!file) return;
+	h.bytes = chunk->alen;
+	bool ok =
+		fwrite(&h, sizeof(h), 1, file) == 1 &&
+		fwrite(chunk->abuf, 1, chunk->alen, file) == chunk->alen;
+	fclose(file);
+	// Half a file would only get rejected next launch anyway
+	if (!ok) remove(path);
 }
 
-void make_player(Player * p, Vector2i pos, int power_level)
-{
-	Texture tex;
-	tex.pos = Vector2i(32 + (16 * power_level), 16);
-	tex.dim = Vector2i(16, 16);
-	tex.scale = Vector2f(1, 1);
-	make_entity(p, pos, tex);
-	p->power_level = power_level;
-	p->power_max   = power_level;
-	p->direction = Vector2i(0, 0);
-	p->queued_direction = Vector2i(0, 0);
-	p->type = PLAYER;
-}
+// One asset, loaded on a loader worker. The result stays in here until
+// the main thread polls the job, so nothing it's reading changes under
+// it.
+struct SoundJob {
+	const char * file; // in sound/
+	bool music;
+	SoundEvent event; // that plays it, SOUND_EVENT_COUNT for music
+	const char * cache_dir; // optional
+	Mix_Music * music_out;
+	Mix_Chunk * chunk_out;
+};
 
-bool update_player(Player * p)
+static const char * load_sound(void * data)
 {
-	if (*game.game_state == GAME_LOSS) {
-		p->death_timer -= window.delta_time;
-		p->flash_timer -= window.delta_time;
-		if (p->flash_timer <= 0) {
-			p->visible = !p->visible;
-			p->flash_timer = PLAYER_FLASH_TIMER_RESET;
-		}
-		return p->death_timer <= 0;
-	}
-	p->tex.pos = Vector2i(48 + (16 * p->power_level), 16);
-	if (!p->moving) {
-		if (!game.level->grid[to_index(p->grid_pos + p->queued_direction)]) {
-			p->direction = p->queued_direction;
+	SoundJob * job = (SoundJob*) data;
+	char * base = SDL_GetBasePath();
+	StringBuilder builder;
+	builder.alloc();
+	builder.append(base);
+	builder.append("..\\sound\\");
+	builder.append(job->file);
+	SDL_free(base);
+	const char * note = NULL;
+	if (job->music) {
+		// Music streams, so there's nothing to decode up front
+		job->music_out = Mix_LoadMUS(builder.str());
+	} else if (!job->cache_dir) {
+		job->chunk_out = Mix_LoadWAV(builder.str());
+		note = "decoded";
+	} else {
+		StringBuilder cache_path;
+		cache_path.alloc();
+		cache_path.append(job->cache_dir);
+		cache_path.append("/");
+		cache_path.append(job->file);
+		cache_path.append(".pcm");
+		PcmCacheHeader header;
+		bool keyed = make_pcm_cache_header(&header, builder.str());
+		if (keyed) job->chunk_out = read_pcm_cache(cache_path.str(), &header);
+		if (job->chunk_out) {
+			note = "from cache";
 		} else {
-			p->direction = Vector2i(0, 0);
+			job->chunk_out = Mix_LoadWAV(builder.str());
+			note = "decoded";
+			if (keyed && job->chunk_out) {
+				write_pcm_cache(cache_path.str(), header, job->chunk_out);
+				note = "decoded, cached";
+			}
 		}
+		cache_path.dealloc();
 	}
-	move_entity(p, p->grid_pos + p->direction);
-	return false;
-}
-
-void keydown_player(Player * p, SDL_Scancode scancode)
-{
-	switch (scancode) {
-	case SDL_SCANCODE_W: {
-		p->queued_direction = Vector2i(+0, -1);
-	} break;
-	case SDL_SCANCODE_A: {
-		p->queued_direction = Vector2i(-1, +0);
-	} break;
-	case SDL_SCANCODE_S: {
-		p->queued_direction = Vector2i(+0, +1);
-	} break;
-	case SDL_SCANCODE_D: {
-		p->queued_direction = Vector2i(+1, +0);
-	} break;
-	case SDL_SCANCODE_LEFT: {
-		if (p->power_level > 0) {
-			p->power_level--;
-		}
-	} break;
-	case SDL_SCANCODE_RIGHT: {
-		if (p->power_level < p->power_max) {
-			p->power_level++;
-		}
-	} break;
-	case SDL_SCANCODE_KP_6: {
-		p->power_max++;
-	} break;
-	case SDL_SCANCODE_KP_4: {
-		p->power_max--;
-	} break;
+	if (!job->music_out && !job->chunk_out) {
+		printf("Couldn't load '%s'\n", builder.str());
+		note = "failed";
 	}
+	builder.dealloc();
+	return note;
 }
 
-void make_ghost(Ghost * g, Vector2i pos, int power_type)
+#define SOUND_COUNT 5
+// The cache directory and results get filled in once loading starts
+static SoundJob sound_jobs[SOUND_COUNT] = {
+	{ "song.ogg", true,  SOUND_EVENT_COUNT,  NULL, NULL, NULL },
+	{ "lose.ogg", false, SOUND_PLAYER_DEATH, NULL, NULL, NULL },
+	{ "yelp.ogg", false, SOUND_GHOST_DEATH,  NULL, NULL, NULL },
+	{ "ring.ogg", false, SOUND_CRYSTAL_GRAB, NULL, NULL, NULL },
+	{ "win.ogg",  false, SOUND_WON_GAME,     NULL, NULL, NULL },
+};
+
+// Queues every sound on the loader. None of them hold up the first
+// frame: until one arrives, events for it just play nothing.
+void init_sounds(Loader * loader, const char * cache_dir)
 {
-	Texture tex;
-	tex.pos = Vector2i(48 + (16 * power_type), 32);
-	tex.dim = Vector2i(16, 16);
-	tex.scale = Vector2f(1, 1);
-	make_entity(g, pos, tex);
-	g->move_div = 0.3 + 0.2 * ((float) (rand() % 100) / 100.0);
-	g->power_type = power_type;
-	g->state = GHOST_ALIVE;
-	g->type  = GHOST;
+	for (int i = 0; i < SOUND_COUNT; i++) {
+		sound_jobs[i].cache_dir = cache_dir;
+		loader_add(loader, sound_jobs[i].file, load_sound, sound_jobs + i);
+	}
 }
 
-// Passing in ghost_list is really just a kluge to fix a bug, but I
-// don't really care at this point.
-bool update_ghost(Ghost * g, List<Ghost> * ghost_list)
+// Takes in whatever sounds finished loading since last frame
+void poll_sounds(Loader * loader)
 {
-	if (g->state == GHOST_DEAD) {
-		g->death_timer -= window.delta_time;
-		g->flash_timer -= window.delta_time;
-		if (g->flash_timer <= 0) {
-			g->visible = !g->visible;
-			g->flash_timer = GHOST_FLASH_TIMER_RESET;
-		}
-		return g->death_timer <= 0;
-	} else if (!g->moving) {
-		List<Vector2i> dirs = a_star(
-			game.level->grid, Level::play_w, Level::play_h,
-			g->grid_pos, game.player->grid_pos);
-		if (dirs.len == 0) {
-			g->direction = Vector2i(0, 0);
-			goto dealloc;
-		}
-		for (int i = 0; i < game.ghosts->len; i++) {
-			if ((*ghost_list)[i].id == g->id) continue;
-			if (g->grid_pos + g->direction == (*ghost_list)[i].grid_pos) {
-				g->direction = Vector2i(0, 0);
-				goto dealloc;
-			}
-			// Kluge Central Station is coming up on your right
-			if (g->grid_pos == (*ghost_list)[i].grid_pos) {
-				(*ghost_list)[i].direction.x *= -1;
-				(*ghost_list)[i].direction.y *= -1;
-			}
+	int i;
+	while ((i = loader_poll(loader)) >= 0) {
+		SoundJob * job = (SoundJob*) loader->jobs[i].data;
+		if (job->music) {
+			sounds.bgm = job->music_out;
+			if (sounds.bgm) Mix_PlayMusic(sounds.bgm, -1);
+		} else {
+			sounds.chunks[job->event].store(job->chunk_out, std::memory_order_release);
 		}
-		g->direction = dirs[0];
-	dealloc:
-		dirs.dealloc();
 	}
-	move_entity(g, g->grid_pos + g->direction);
-	return false;
 }
 
-void kill_ghost(Ghost * g)
+struct Window {
+	Vector2i res;
+	SDL_Window * sdl;
+	// Only with --soft. Render draws one sprite per call and can't
+	// draw into a texture, so the baked layers still cost a call per
+	// sprite there. In software the walls live in soft's base buffer
+	// and the finished frame reaches the screen as one texture copy.
+	SDL_Renderer * renderer;
+	SDL_Texture * frame;
+	SoftRender soft;
+};
+
+static Window window;
+
+void draw_entity(const Entity * e)
 {
-	if (g->state == GHOST_DEAD) return;
-	g->state = GHOST_DEAD;
-	Mix_PlayChannel(-1, sounds.ghost_death, 0);	
-	// TODO(pixlark): Not very robust, if we want to make the ghost
-	// alive again, then we have to set the texture position
-	// again. But on the other hand, this time it's a one-time
-	// operation rather than an extra if-statement every
-	// frame. Probably doesn't matter either way but worth thinking
-	// about.
-	g->tex.pos.y = 48;
-	g->death_timer = GHOST_DEATH_TIMER_RESET;
-	g->flash_timer = GHOST_FLASH_TIMER_RESET;
+	if (!e->visible) return;
+	Render::render(e->pos, e->tex.pos, e->tex.dim, e->tex.scale);
 }
 
-Window make_window()
+Window make_window(bool soft)
 {
 	float res_scale = 4.0;
 	Window window;
@@ -337,308 +225,293 @@ Window make_window()
 	window.sdl = SDL_CreateWindow("NES game",
 		SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
 		window.res.x * res_scale, window.res.y * res_scale,
-		SDL_WINDOW_SHOWN|SDL_WINDOW_OPENGL);
+		SDL_WINDOW_SHOWN|(soft ? 0 : SDL_WINDOW_OPENGL));
+	window.renderer = NULL;
+	window.frame = NULL;
 	{
 		List<char> exe_path = get_exe_dir();
 		exe_path.cat("..\\atlas.png", 13, 1);
 		printf("Loading atlas from %s\n", exe_path.arr);
 	
-		Render::init(window.sdl, exe_path.arr, window.res, res_scale);
+		if (!soft) {
+			Render::init(window.sdl, exe_path.arr, window.res, res_scale);
+		} else if (make_soft_render(&window.soft, exe_path.arr, window.res)) {
+			window.renderer = SDL_CreateRenderer(window.sdl, -1, 0);
+			SDL_RenderSetLogicalSize(window.renderer, window.res.x, window.res.y);
+			// SoftRender's R, G, B, A bytes
+			window.frame = SDL_CreateTexture(window.renderer, SDL_PIXELFORMAT_RGBA32,
+				SDL_TEXTUREACCESS_STREAMING, window.res.x, window.res.y);
+		} else {
+			printf("Couldn't load %s\n", exe_path.arr);
+			exit(1);
+		}
 
 		exe_path.dealloc();
 	}
-	window.last_time = SDL_GetPerformanceCounter();
 	return window;
 }
 
-bool v2_equality(Vector2i a, Vector2i b) {
-	return a.x == b.x && a.y == b.y;
-}
-
-void generate_level(Level * level)
-{
-	auto add_walls_to_list = [level](Vector2i w, List<Vector2i> * l) {
-		for (int i = 0; i < 4; i++) {
-			Vector2i n = w + directions[i];
-			if (level->grid[to_index(n)]) {
-				if (l->find(n, v2_equality) == -1 &&
-					n.x >= 1 && n.x < Level::play_w - 1 && n.y >= 1 && n.y < Level::play_h - 1) {
-					l->push(n);
-				}
-			}
-		}
-	};
-	auto tunnel_from_point = [level, add_walls_to_list](Vector2i p) {
-		List<Vector2i> walls;
-		level->grid[to_index(p)] = 0;
-		walls.alloc();
-		add_walls_to_list(p, &walls);
-		while (1) {
-			if (walls.len == 0) break;
-			int wi = rand() % walls.len;
-			Vector2i w = walls[wi];
-			int bordering = 0;
-			for (int i = 0; i < 4; i++) {
-				if (!level->grid[to_index(w + directions[i])]) {
-					bordering++;
-				}
-			}
-			if (bordering == 1) {
-				level->grid[to_index(w)] = 0;
-				add_walls_to_list(w, &walls);
-			}
-			walls.remove(wi);
-		}
-		walls.dealloc();
-	};
-	Vector2i start;
-	if (level->top_left) {
-		start.x = 1;
-		start.y = 1;
-		level->crystal_pos.x = Level::play_w - 2;
-		level->crystal_pos.y = Level::play_h - 2;
-	} else {
-		start.x = Level::play_w - 2;
-		start.y = Level::play_h - 2;
-		level->crystal_pos.x = 1;
-		level->crystal_pos.y = 1;
-	}
-	for (int i = 0; i < Level::play_w*Level::play_h; i++) level->grid[i] = 1;
-	tunnel_from_point(start);
-	{
-		// Readjust crystal pos
-		Vector2i dir = level->top_left ? Vector2i(-1, -1) : Vector2i(1, 1);
-		while (level->grid[to_index(level->crystal_pos)]) {
-			// TODO(pixlark): This has about a 1/2048 chance (I
-			// think) of failing if the maze generation forms a
-			// perfect diagonal line.
-			level->crystal_pos += dir;
-		}
-	}
-	// Turn level into entity list that can be rendered
-	level->walls.dealloc();
-	level->walls.alloc();
-	for (int y = 0; y < Level::play_h; y++) {
-		for (int x = 0; x < Level::play_w; x++) {
-			if (level->grid[to_index(x, y)]) {
-				Entity e;
-				Texture t;
-				t.pos = Vector2i(0, 5 * 16);
-				t.dim = Vector2i(16, 16);
-				t.scale = Vector2f(1, 1);
-				make_entity(&e, Vector2i(x, y), t);
-				level->walls.push(e);
-			}
-		}
-	}
-	level->top_left = !level->top_left;
-}
-
-Vector2i get_empty_level_spot(const Level * l)
+void destroy_window(Window * window)
 {
-	Vector2i pos;
-	do {
-		pos.x = rand() % Level::play_w;
-		pos.y = rand() % Level::play_h;
-	} while (l->grid[to_index(pos)]);
-	return pos;
-}
-
-void draw_level(Level * l)
-{
-	for (int i = 0; i < l->walls.len; i++) {
-		draw_entity(l->walls.arr + i);
+	if (window->frame) {
+		SDL_DestroyTexture(window->frame);
+		SDL_DestroyRenderer(window->renderer);
+		destroy_soft_render(&window->soft);
 	}
-	Render::render(
-		Vector2i(l->crystal_pos.x * 16, l->crystal_pos.y * 16),
-		Vector2i((game.player->power_max + 1) * 16 + 48, 0), Vector2i(16, 16), Vector2f(1, 1));
 }
 
-
-int ghosts_per_level[] = {
-	1, 2, 2, 3,
-	3, 4, 4, 5,
-};
-
-#define MINIMUM_GHOST_DISTANCE 16 * 5
-void generate_ghosts(List<Ghost> * ghosts, int power)
+void draw_layer(const DrawLayer * layer)
 {
-	ghosts->dealloc();
-	ghosts->alloc();
-	for (int i = 0; i < ghosts_per_level[power]; i++) {
-		Ghost g;
-		int j = 0;
-		do {
-			j++;
-			make_ghost(&g, get_empty_level_spot(game.level), rand() % (power + 1));
-		} while (
-			SQR(MINIMUM_GHOST_DISTANCE) >
-			(SQR(g.pos.y - game.player->pos.y) + SQR(g.pos.x - game.player->pos.x)));
-		g.id = ghosts->len;
-		ghosts->push(g);
+	for (int i = 0; i < layer->cmds.len; i++) {
+		const DrawCmd * c = layer->cmds.arr + i;
+		Render::render(c->pos, c->tex_pos, c->tex_dim, c->scale);
 	}
 }
 
-void reset_level(Level * level, List<Ghost> * ghosts, int power_level)
+void draw_level(DrawLayer * walls, const Level * l, const Player * player)
 {
-	// Level generation
-	generate_level(level);
-	// Ghost stuff
-	generate_ghosts(ghosts, power_level);
+	TRACE_SCOPE("draw_level");
+	bake_wall_layer(walls, l);
+	draw_layer(walls);
+	DrawCmd crystal = crystal_cmd(l, player);
+	Render::render(crystal.pos, crystal.tex_pos, crystal.tex_dim, crystal.scale);
 }
 
-int check_crystal(Level * level, Player * player, List<Ghost> * ghosts)
+// Runs on the audio thread
+static void mixer_play(void * user, SoundEvent e)
 {
-	if (player->grid_pos.x == level->crystal_pos.x &&
-		player->grid_pos.y == level->crystal_pos.y) {
-		
-		Mix_PlayChannel(-1, sounds.crystal_grab, 0);
-		
-		// Player stuff
-		player->power_max++;
-		
-		if (player->power_max < 8) {
-			player->power_level = player->power_max;
-			player->grid_pos = level->top_left ? Vector2i(1, 1) : Vector2i(Level::play_w - 2, Level::play_h - 2);
-			player->pos = Vector2i(player->grid_pos.x * 16, player->grid_pos.y * 16);
-			player->queued_direction = Vector2i(0, 0);
-			reset_level(level, ghosts, player->power_max);
-		} else {
-			Mix_PlayChannel(-1, sounds.won_game, 0);
-			return 1;
-		}
+	Sounds * s = (Sounds*) user;
+	Mix_Chunk * chunk = s->chunks[e].load(std::memory_order_acquire);
+	// Not loaded yet (or at all)
+	if (!chunk || Mix_PlayChannel(-1, chunk, 0) < 0) return;
+	if (s->bytes_per_second <= 0) return;
+	int64_t end = pacer_now() + (int64_t) chunk->alen * 1000000000 / s->bytes_per_second;
+	if (end > s->busy_until.load(std::memory_order_relaxed)) {
+		s->busy_until.store(end, std::memory_order_release);
 	}
-	return 0;
 }
 
-bool colliding(Entity * a, Entity * b, int buffer)
+bool key_from_scancode(SDL_Scancode scancode, Key * key)
 {
-	Vector2i bf = Vector2i(buffer, buffer);
-	Vector2i p0 = a->pos     + bf;
-	Vector2i d0 = a->tex.dim - bf; 
-	Vector2i p1 = b->pos     + bf;
-	Vector2i d1 = b->tex.dim - bf;
-	if (p0.x < p1.x + d1.x && p0.x + d0.x > p1.x &&
-		p0.y < p1.y + d1.y && p0.y + d0.y > p1.y) {
-		return true;
+	switch (scancode) {
+	case SDL_SCANCODE_W:     *key = KEY_UP;             return true;
+	case SDL_SCANCODE_A:     *key = KEY_LEFT;           return true;
+	case SDL_SCANCODE_S:     *key = KEY_DOWN;           return true;
+	case SDL_SCANCODE_D:     *key = KEY_RIGHT;          return true;
+	case SDL_SCANCODE_LEFT:  *key = KEY_POWER_DOWN;     return true;
+	case SDL_SCANCODE_RIGHT: *key = KEY_POWER_UP;       return true;
+	case SDL_SCANCODE_KP_6:  *key = KEY_POWER_MAX_UP;   return true;
+	case SDL_SCANCODE_KP_4:  *key = KEY_POWER_MAX_DOWN; return true;
+	default: return false;
 	}
-	return false;
 }
 
-void check_collision(Player * player, List<Ghost> * ghosts, GameState * game_state)
+int main(int argc, char ** argv)
 {
-	for (int i = ghosts->len - 1; i >= 0; i--) {
-		if ((*ghosts)[i].state == GHOST_ALIVE &&
-			colliding(player, ghosts->arr + i, 4)) {
-			if (player->power_level == (*ghosts)[i].power_type) {
-				kill_ghost(ghosts->arr + i);
-			} else if (*game_state != GAME_LOSS) {
-				// TODO(pixlark): This should really be somewhere else
-				player->death_timer = PLAYER_DEATH_TIMER_RESET;
-				(*game_state) = GAME_LOSS;
-				Mix_PlayChannel(-1, sounds.player_death, 0);
-			}
+	const char * record_path = NULL;
+	const char * trace_path = NULL;
+	const char * pack_path = NULL;
+	const char * sound_cache = NULL;
+	double fps = 60;
+	bool pre_turn = false;
+	bool soft = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			record_path = argv[++i];
+		} else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+			fps = atof(argv[++i]);
+			if (fps <= 0) fps = 60;
+		} else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			trace_path = argv[++i];
+		} else if (strcmp(argv[i], "--sound-cache") == 0 && i + 1 < argc) {
+			sound_cache = argv[++i];
+		} else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc) {
+			pack_path = argv[++i];
+		} else if (strcmp(argv[i], "--pre-turn") == 0) {
+			pre_turn = true;
+		} else if (strcmp(argv[i], "--soft") == 0) {
+			soft = true;
 		}
 	}
-}
 
-void tick_delta_time()
-{
-	uint32_t new_time = SDL_GetPerformanceCounter();
-	window.delta_time = (float) (new_time - window.last_time) / SDL_GetPerformanceFrequency();
-	window.last_time = new_time;
-	if (window.delta_time < 1.0 / 60.0) {
-		SDL_Delay(((1.0 / 60.0) - window.delta_time) * 1000);
-	}
-}
-
-int main()
-{
-	srand(time(NULL));
-	
+	Loader loader;
+	make_loader(&loader);
+	int64_t step_start = loader_now(&loader);
 	SDL_Init(SDL_INIT_VIDEO|SDL_INIT_AUDIO);
-	window = make_window();
+	loader_time(&loader, "SDL_Init", step_start);
 
+	// The mixer has to be open before anything decodes, since
+	// chunks get converted to its format. Then the sounds load while
+	// the window and atlas come up.
+	step_start = loader_now(&loader);
 	Mix_Init(MIX_INIT_OGG);
 	Mix_OpenAudio(MIX_DEFAULT_FREQUENCY, MIX_DEFAULT_FORMAT, 2, 1024);
-	init_sounds();
-	Mix_PlayMusic(sounds.bgm, -1);
-
-	GameState game_state = GAME_PLAYING;
-	game.game_state = &game_state;
-	
-	Player player;
-	make_player(&player, Vector2i(1, 1), -1);
-	game.player = &player;
-	
-	Level level;
-	generate_level(&level);
-	game.level = &level;
+	{
+		int freq, channels;
+		Uint16 format;
+		if (Mix_QuerySpec(&freq, &format, &channels)) {
+			// Low byte of an SDL audio format is its sample bit size
+			sounds.bytes_per_second = freq * channels * ((format & 0xFF) / 8);
+		}
+	}
+	// The sim only ever pushes events; this thread is what calls into
+	// the mixer
+	SoundQueue sound_queue;
+	make_sound_queue(&sound_queue);
+	AudioSink mixer_sink;
+	make_audio_sink(&mixer_sink, mixer_play, &sounds);
+	AudioThread audio_thread;
+	start_audio_thread(&audio_thread, &sound_queue, &mixer_sink);
+	loader_time(&loader, "audio device", step_start);
+	init_sounds(&loader, sound_cache);
+	loader_start(&loader);
+
+	// GL context and atlas, which have to be on this thread
+	step_start = loader_now(&loader);
+	window = make_window(soft);
+	loader_time(&loader, "window + atlas", step_start);
+
+	Sim sim;
+	make_sim(&sim, time(NULL));
+	if (pre_turn) sim.flags |= SIM_PRE_TURN;
+	sim.sounds = &sound_queue;
+	LevelPack pack;
+	if (pack_path) {
+		if (open_level_pack(&pack, pack_path)) {
+			sim_use_level_pack(&sim, &pack);
+			printf("Playing %u levels from %s\n", pack.header.level_count, pack_path);
+		} else {
+			printf("Couldn't open level pack %s\n", pack_path);
+			pack_path = NULL;
+		}
+	}
+	SimClock clock;
+	make_sim_clock(&clock);
+
+	Recorder recorder;
+	if (record_path) {
+		if (make_recorder(&recorder, record_path, &sim, clock.dt)) {
+			sim.recorder = &recorder;
+			printf("Recording input to %s\n", record_path);
+		} else {
+			printf("Couldn't open %s for recording\n", record_path);
+		}
+	}
 
-	List<Ghost> ghosts;
-	ghosts.alloc();
-	game.ghosts = &ghosts;
+	DrawLayer wall_layer;
+	make_draw_layer(&wall_layer);
+	DrawLayer hud_layer;
+	make_draw_layer(&hud_layer);
 	
+	FramePacer pacer;
+	make_frame_pacer(&pacer, fps);
+	LatencyMeter latency;
+	make_latency_meter(&latency);
+	// SDL stamps events in milliseconds since init; this maps them
+	// onto the pacer's clock
+	int64_t ticks_base = pacer_now() - (int64_t) SDL_GetTicks() * 1000000;
+
+	bool traced_spike = false;
+	// Dumps are rate-limited, and the frame after one is never
+	// counted as a spike, so a dump can't set off the next
+	const int64_t trace_dump_gap = 1000000000;
+	int64_t last_trace_dump = 0;
+	bool skip_spike_check = false;
 	SDL_Event event;
 	bool running = true;
 	while (running) {
+		// Wait first, so input is sampled straight after and is as
+		// fresh as it can be when the sim reads it
+		pacer_wait(&pacer);
+		// Keep the most recent hitch on disk, while its scopes are
+		// still in the ring
+		if (trace_path && !skip_spike_check &&
+			pacer.delta_time * 1e9 > 2 * pacer.period &&
+			(!traced_spike || pacer.last - last_trace_dump >= trace_dump_gap)) {
+			// Written on a background thread from a copy of the rings
+			if (trace_dump_async(trace_path)) {
+				traced_spike = true;
+				last_trace_dump = pacer.last;
+				skip_spike_check = true;
+			}
+		} else {
+			skip_spike_check = false;
+		}
+		Input input;
+		input.key_count = 0;
 		while (SDL_PollEvent(&event) != 0) {
 			switch (event.type) {
 			case SDL_QUIT:
 				running = false;
 				break;
-			case SDL_KEYDOWN:
-				if (game_state == GAME_PLAYING) {
-					keydown_player(&player, event.key.keysym.scancode);
+			case SDL_KEYDOWN: {
+				Key key;
+				if (key_from_scancode(event.key.keysym.scancode, &key)) {
+					input_push(&input, key);
+					latency_event(&latency, ticks_base + (int64_t) event.key.timestamp * 1000000);
 				}
-				break;
+			} break;
 			}
 		}
-		if (game_state != GAME_WIN) {
-			// Player dies
-			if (update_player(&player)) {
-				make_player(&player, Vector2i(1, 1), -1);
-				level.top_left = true; // TODO(pixlark): Klugey way to do it
-				reset_level(&level, &ghosts, -1);
-				game_state = GAME_PLAYING;
-			}
-			for (int i = 0; i < ghosts.len; i++) {
-				if (update_ghost(ghosts.arr + i, &ghosts)) {
-					ghosts.remove(i);
-				}
+		if (sim.game_state == GAME_WIN) {
+			// Hold the last frame until the win jingle (and anything
+			// else still going) has played out
+			if (audio_caught_up(&sound_queue, &mixer_sink) &&
+				pacer_now() >= sounds.busy_until.load(std::memory_order_acquire)) {
+				break;
 			}
-			if (check_crystal(&level, &player, &ghosts)) {
-				game_state = GAME_WIN;
-			};
-			check_collision(&player, &ghosts, &game_state);
-		} else {
-			if (Mix_Playing(-1) == 0) return 0;
 		}
+		poll_sounds(&loader);
+		sim_advance(&sim, &clock, input, pacer.delta_time);
+		latency_consumed(&latency, clock.pending.key_count == 0);
 		
-		Render::clear(RGBA(36, 56, 225, 255));
-		draw_level (&level);
-		draw_entity(&player);
-		for (int i = 0; i < ghosts.len; i++) {
-			draw_entity(ghosts.arr + i);
-		}
-
-		{
-			// Draw UI stuff
-			// TODO(pixlark): Put this all in a UI struct or something
-			for (int i = 0; i < 8; i++) {
-				if (i == player.power_level) {
-					Render::render(Vector2i(i * 32, window.res.y - 32), Vector2i(0, 48), Vector2i(32, 32), Vector2f(1, 1));
-				} else {
-					Render::render(Vector2i(i * 32, window.res.y - 32), Vector2i(0, 16), Vector2i(32, 32), Vector2f(1, 1));
+		if (window.frame) {
+			TRACE_SCOPE("draw_soft");
+			const uint32_t * pixels = soft_render_sim(&window.soft, &sim);
+			SDL_UpdateTexture(window.frame, NULL, pixels, window.res.x * sizeof(uint32_t));
+			SDL_RenderCopy(window.renderer, window.frame, NULL, NULL);
+		} else {
+			Render::clear(RGBA(36, 56, 225, 255));
+			draw_level (&wall_layer, &sim.level, &sim.player);
+			draw_entity(&sim.player);
+			for (int i = 0; i < sim.ghosts.count; i++) {
+				DrawCmd ghost;
+				if (ghost_cmd(&sim.ghosts, i, &ghost)) {
+					Render::render(ghost.pos, ghost.tex_pos, ghost.tex_dim, ghost.scale);
 				}
 			}
-			for (int i = 0; i < player.power_max + 1; i++) {
-				Render::render(Vector2i(i * 32 + 8, window.res.y - 24), Vector2i(i * 16 + 48, 0), Vector2i(16, 16), Vector2f(1, 1));
+			TRACE_SCOPE("draw_hud");
+			bake_hud_layer(&hud_layer, &sim.player, window.res);
+			draw_layer(&hud_layer);
+		}
+		{
+			TRACE_SCOPE("swap");
+			if (window.frame) {
+				SDL_RenderPresent(window.renderer);
+			} else {
+				Render::swap(window.sdl);
 			}
-			Render::render(Vector2i(0, window.res.y - 48), Vector2i(0, 0), Vector2i(16, 16), Vector2f(16, 1));
 		}
-		Render::swap(window.sdl);
-		tick_delta_time();
+		latency_presented(&latency, pacer_now());
+		loader_first_frame(&loader);
+		if (!loader.reported && loader_done(&loader)) {
+			loader_report(&loader, stdout);
+			loader.reported = true;
+		}
+	}
+	if (sim.recorder) {
+		close_recorder(sim.recorder, sim.frame);
 	}
+	pacer_report(&pacer, stdout);
+	latency_report(&latency, stdout);
+	trace_flush();
+	if (trace_path && !traced_spike) trace_dump(trace_path);
+	destroy_frame_pacer(&pacer);
+	destroy_draw_layer(&hud_layer);
+	destroy_draw_layer(&wall_layer);
+	destroy_window(&window);
+	if (pack_path) close_level_pack(&pack);
+	stop_audio_thread(&audio_thread);
+	destroy_loader(&loader);
 	return 0;
 }
@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "nexthop.h"
+#include "trace.h"
+
+static const Vector2i directions[] = {
+	{+0, -1}, // UP
+	{-1, +0}, // LEFT
+	{+0, +1}, // DOWN
+	{+1, +0}, // RIGHT
+};
+
+void make_next_hop_table(NextHopTable * t, size_t max_bytes, Pool * pool)
+{
+	memset(t, 0, sizeof(NextHopTable));
+	t->max_bytes = max_bytes;
+	t->pool = pool;
+}
+
+void destroy_next_hop_table(NextHopTable * t)
+{
+	free(t->cell_of);
+	free(t->grid_of);
+	free(t->dirs);
+	free(t->dist);
+	memset(t, 0, sizeof(NextHopTable));
+}
+
+// BFS out from one target. A cell first reached from its neighbour in
+// direction i gets the opposite direction, (i + 2) % 4, as its hop.
+static void build_row(void * data, int to)
+{
+	NextHopTable * t = (NextHopTable*) data;
+	int w = t->width, h = t->height;
+	uint8_t * dist = t->dist + (size_t) to * t->cell_count;
+	uint8_t * dirs = t->dirs + (size_t) to * t->row_bytes;
+	memset(dist, HOP_UNREACHABLE, t->cell_count);
+	memset(dirs, 0, t->row_bytes);
+
+	// Open cells are numbered densely, so the queue never outgrows
+	// cell_count. Small mazes fit on the stack.
+	int stack_queue[512];
+	int * queue = t->cell_count <= 512 ? stack_queue : (int*) malloc(sizeof(int) * t->cell_count);
+	int head = 0, tail = 0;
+	dist[to] = 0;
+	queue[tail++] = t->grid_of[to];
+	while (head < tail) {
+		int c = queue[head++];
+		uint8_t cd = dist[t->cell_of[c]];
+		int cx = c % w;
+		int cy = c / w;
+		for (int i = 0; i < 4; i++) {
+			int nx = cx + directions[i].x;
+			int ny = cy + directions[i].y;
+			if (nx < 0 || nx >= w || ny < 0 || ny >= h) continue;
+			int n = t->cell_of[nx + ny * w];
+			if (n < 0 || dist[n] != HOP_UNREACHABLE) continue;
+			dist[n] = cd < HOP_MAX_DIST ? cd + 1 : HOP_MAX_DIST;
+			dirs[n >> 2] |= ((i + 2) % 4) << ((n & 3) * 2);
+			queue[tail++] = nx + ny * w;
+		}
+	}
+	if (queue != stack_queue) free(queue);
+}
+
+// Sizes the table for grid and numbers its open cells, everything but
+// the rows themselves
+static bool layout_table(NextHopTable * t, const int * grid, int width, int height)
+{
+	t->valid = false;
+	int cells = width * height;
+	int open = 0;
+	for (int i = 0; i < cells; i++) {
+		if (!grid[i]) open++;
+	}
+	int row_bytes = (open + 3) / 4;
+	size_t bytes =
+		sizeof(int16_t) * cells + sizeof(int) * open +
+		(size_t) open * row_bytes + (size_t) open * open;
+	if (bytes > t->max_bytes || open > INT16_MAX) return false;
+
+	// Grow-only, so regenerating a level of the same size doesn't
+	// touch the allocator.
+	if (cells > t->cell_capacity) {
+		free(t->cell_of);
+		t->cell_of = (int16_t*) malloc(sizeof(int16_t) * cells);
+		t->cell_capacity = cells;
+	}
+	if (open > t->open_capacity) {
+		free(t->grid_of);
+		free(t->dirs);
+		free(t->dist);
+		t->grid_of = (int*) malloc(sizeof(int) * open);
+		t->dirs = (uint8_t*) malloc((size_t) open * row_bytes);
+		t->dist = (uint8_t*) malloc((size_t) open * open);
+		t->open_capacity = open;
+	}
+	t->width = width;
+	t->height = height;
+	t->cell_count = open;
+	t->row_bytes = row_bytes;
+	t->bytes = bytes;
+	int id = 0;
+	for (int i = 0; i < cells; i++) {
+		if (grid[i]) {
+			t->cell_of[i] = -1;
+		} else {
+			t->cell_of[i] = id;
+			t->grid_of[id++] = i;
+		}
+	}
+	return true;
+}
+
+bool build_next_hop_table(NextHopTable * t, const int * grid, int width, int height)
+{
+	TRACE_SCOPE("build_next_hop_table");
+	if (!layout_table(t, grid, width, height)) return false;
+	int open = t->cell_count;
+	if (t->pool) {
+		pool_for(t->pool, open, build_row, t);
+	} else {
+		for (int to = 0; to < open; to++) build_row(t, to);
+	}
+	t->valid = true;
+	return true;
+}
+
+bool load_next_hop_table(
+	NextHopTable * t, const int * grid, int width, int height,
+	const uint8_t * dirs, const uint8_t * dist)
+{
+	TRACE_SCOPE("load_next_hop_table");
+	if (!layout_table(t, grid, width, height)) return false;
+	memcpy(t->dirs, dirs, (size_t) t->cell_count * t->row_bytes);
+	memcpy(t->dist, dist, (size_t) t->cell_count * t->cell_count);
+	t->valid = true;
+	return true;
+}
@@ -0,0 +1,73 @@
+#ifndef NES_NEXTHOP_H
+#define NES_NEXTHOP_H
+
+// All-pairs next-hop table for a static grid. One BFS per open cell,
+// after which "which way from a to b" is a single lookup.
+//
+// Per (to, from) pair it stores a 2-bit direction (packed four to a
+// byte) and a saturating 8-bit distance, so a full 16x13 maze costs
+// about 55 KB. Directions index the usual UP, LEFT, DOWN, RIGHT
+// table.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility.h>
+
+#include "pool.h"
+
+#define HOP_UNREACHABLE 0xFF
+#define HOP_MAX_DIST    0xFE
+
+struct NextHopTable {
+	// Refuse to build if the table would need more than this
+	size_t max_bytes;
+	// Optional, builds serially when NULL
+	Pool * pool;
+
+	bool valid;
+	int width, height;
+	int cell_count;   // open cells
+	int16_t * cell_of; // grid index -> open cell id, -1 for walls
+	int * grid_of;     // open cell id -> grid index
+	int row_bytes;     // bytes per packed direction row
+	uint8_t * dirs;    // [to][from], 2 bits each
+	uint8_t * dist;    // [to][from]
+	size_t bytes;
+	int cell_capacity;
+	int open_capacity;
+};
+
+void make_next_hop_table(NextHopTable * t, size_t max_bytes, Pool * pool = NULL);
+void destroy_next_hop_table(NextHopTable * t);
+
+// Returns false (and leaves the table invalid) if the grid needs more
+// than max_bytes.
+bool build_next_hop_table(NextHopTable * t, const int * grid, int width, int height);
+// Same result as build_next_hop_table, from dirs and dist rows saved
+// off an earlier build of the same grid (laid out as in the table).
+// Two memcpys instead of a BFS per open cell.
+bool load_next_hop_table(
+	NextHopTable * t, const int * grid, int width, int height,
+	const uint8_t * dirs, const uint8_t * dist);
+
+inline int hop_distance(const NextHopTable * t, int from_index, int to_index)
+{
+	int f = t->cell_of[from_index];
+	int d = t->cell_of[to_index];
+	if (f < 0 || d < 0) return HOP_UNREACHABLE;
+	return t->dist[(size_t) d * t->cell_count + f];
+}
+
+// Direction index of the first step from from_index toward to_index,
+// or -1 if they're the same cell or not connected.
+inline int next_hop(const NextHopTable * t, int from_index, int to_index)
+{
+	int f = t->cell_of[from_index];
+	int d = t->cell_of[to_index];
+	if (f < 0 || d < 0 || f == d) return -1;
+	if (t->dist[(size_t) d * t->cell_count + f] == HOP_UNREACHABLE) return -1;
+	uint8_t packed = t->dirs[(size_t) d * t->row_bytes + (f >> 2)];
+	return (packed >> ((f & 3) * 2)) & 3;
+}
+
+#endif
@@ -0,0 +1,71 @@
+#include <string.h>
+
+#include "observe.h"
+
+// Power levels run -1..7, power types 0..7
+static int clamp_power(int power, int lowest)
+{
+	return power < lowest ? lowest : power > 7 ? 7 : power;
+}
+
+void observe_tiles(const Sim * sim, uint8_t * out)
+{
+	const Level * level = &sim->level;
+	for (int i = 0; i < OBSERVE_TILES; i++) {
+		out[i] = level->grid[i] ? TILE_WALL : TILE_FLOOR;
+	}
+	out[to_index(level->crystal_pos)] = TILE_CRYSTAL;
+	const Ghosts * gs = &sim->ghosts;
+	for (int i = 0; i < gs->count; i++) {
+		if (!gs->visible[i]) continue;
+		out[to_index(gs->grid_x[i], gs->grid_y[i])] = gs->state[i] == GHOST_DEAD ?
+			TILE_GHOST_DEAD : TILE_GHOST + clamp_power(gs->power_type[i], 0);
+	}
+	const Player * player = &sim->player;
+	if (player->visible) {
+		out[to_index(player->grid_pos)] = TILE_PLAYER + 1 + clamp_power(player->power_level, -1);
+	}
+}
+
+void observe_tiles_batch(const Batch * batch, uint8_t * out)
+{
+	for (int i = 0; i < batch->count; i++) {
+		observe_tiles(batch->sims + i, out + i * OBSERVE_TILES);
+	}
+}
+
+int observe_entities(const Sim * sim, ObserveEntity * out)
+{
+	const Player * player = &sim->player;
+	out->x = (int16_t) player->pos.x;
+	out->y = (int16_t) player->pos.y;
+	out->grid_x = (uint8_t) player->grid_pos.x;
+	out->grid_y = (uint8_t) player->grid_pos.y;
+	out->power = (int8_t) player->power_level;
+	out->flags =
+		(player->visible ? OBSERVE_VISIBLE : 0) |
+		(player->moving ? OBSERVE_MOVING : 0);
+	const Ghosts * gs = &sim->ghosts;
+	for (int i = 0; i < gs->count; i++) {
+		ObserveEntity * e = out + 1 + i;
+		e->x = (int16_t) gs->pos_x[i];
+		e->y = (int16_t) gs->pos_y[i];
+		e->grid_x = (uint8_t) gs->grid_x[i];
+		e->grid_y = (uint8_t) gs->grid_y[i];
+		e->power = (int8_t) gs->power_type[i];
+		e->flags =
+			(gs->visible[i] ? OBSERVE_VISIBLE : 0) |
+			(gs->moving[i] ? OBSERVE_MOVING : 0) |
+			(gs->state[i] == GHOST_DEAD ? OBSERVE_DEAD : 0);
+	}
+	return 1 + gs->count;
+}
+
+void observe_entities_batch(const Batch * batch, ObserveEntity * out)
+{
+	for (int i = 0; i < batch->count; i++) {
+		ObserveEntity * game = out + i * OBSERVE_ENTITIES;
+		int count = observe_entities(batch->sims + i, game);
+		memset(game + count, 0, sizeof(ObserveEntity) * (OBSERVE_ENTITIES - count));
+	}
+}
@@ -0,0 +1,59 @@
+#ifndef NES_OBSERVE_H
+#define NES_OBSERVE_H
+
+// Tile-ID observations: the play field as one byte per cell, straight
+// from Level::grid with the entities stamped on top, plus a small
+// record per entity for the positions a grid can't hold. Well under
+// 1 KB a frame against 240 KB for the rendered RGBA one, and no atlas
+// needed. (For pixels without the RGBA cost see
+// soft_render_sim_indexed.)
+
+#include <stdint.h>
+
+#include "batch.h"
+#include "sim.h"
+
+enum Tile {
+	TILE_FLOOR      = 0,
+	TILE_WALL       = 1,
+	TILE_CRYSTAL    = 2,
+	TILE_PLAYER     = 3,  // + power level + 1, 3..11 (power -1 is no crystal yet)
+	TILE_GHOST      = 12, // + power type, 12..19
+	TILE_GHOST_DEAD = 20, // killed, flashing out; can't hurt the player
+	TILE_COUNT      = 21,
+};
+
+const int OBSERVE_TILES = Level::play_w * Level::play_h;
+
+// out must hold OBSERVE_TILES bytes, row-major like Level::grid.
+// Entities sit on the cell they last arrived at, and later ones win:
+// crystal, ghosts, then the player, so the player still shows on the
+// frame a ghost catches them. observe_entities has the rest.
+void observe_tiles(const Sim * sim, uint8_t * out);
+// Every game in the batch, OBSERVE_TILES bytes apiece
+void observe_tiles_batch(const Batch * batch, uint8_t * out);
+
+enum ObserveFlag {
+	OBSERVE_VISIBLE = 1 << 0,
+	OBSERVE_MOVING  = 1 << 1,
+	OBSERVE_DEAD    = 1 << 2, // ghosts only
+};
+
+// Where an entity really is, between tiles included
+struct ObserveEntity {
+	int16_t x, y;           // pixels
+	uint8_t grid_x, grid_y; // the tile it last arrived at
+	int8_t power;           // player: power level, -1 for none; ghost: power type
+	uint8_t flags;          // ObserveFlag
+};
+
+const int OBSERVE_ENTITIES = 1 + SIM_MAX_GHOSTS;
+
+// The player into out[0] and the ghosts after it, in Ghosts order.
+// out must hold OBSERVE_ENTITIES records; returns how many it wrote.
+int observe_entities(const Sim * sim, ObserveEntity * out);
+// Every game in the batch, OBSERVE_ENTITIES records apiece, with the
+// slots past each game's ghosts zeroed
+void observe_entities_batch(const Batch * batch, ObserveEntity * out);
+
+#endif
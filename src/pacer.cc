@@ -0,0 +1,142 @@
+#include "pacer.h"
+
+#include <chrono>
+#include <string.h>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <mmsystem.h>
+#endif
+
+// Windows only wakes sleepers on the scheduler tick, which is 1 ms at
+// best even after timeBeginPeriod; Linux nanosleep is usually within
+// 100 us. Spin for a bit more than that.
+#ifdef _WIN32
+static const int64_t default_spin = 2000000;
+#else
+static const int64_t default_spin = 500000;
+#endif
+
+void histogram_add(TimeHistogram * h, int64_t ns)
+{
+	int bucket = (int) (ns / 1000 / PACER_BUCKET_US);
+	if (bucket < 0) bucket = 0;
+	if (bucket >= PACER_BUCKETS) bucket = PACER_BUCKETS - 1;
+	h->buckets[bucket]++;
+	h->count++;
+	if (ns > h->worst) h->worst = ns;
+}
+
+double histogram_percentile(const TimeHistogram * h, double p)
+{
+	if (h->count == 0) return 0;
+	uint32_t rank = (uint32_t) (p * (h->count - 1));
+	uint32_t seen = 0;
+	for (int i = 0; i < PACER_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen > rank) return (i + 0.5) * PACER_BUCKET_US / 1000.0;
+	}
+	return PACER_BUCKETS * PACER_BUCKET_US / 1000.0;
+}
+
+int64_t pacer_now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void make_frame_pacer(FramePacer * pacer, double hz)
+{
+#ifdef _WIN32
+	timeBeginPeriod(1);
+#endif
+	memset(pacer, 0, sizeof(FramePacer));
+	pacer->period = (int64_t) (1e9 / hz);
+	pacer->spin = default_spin;
+	pacer->last = pacer_now();
+	pacer->deadline = pacer->last + pacer->period;
+	pacer->delta_time = (float) (1.0 / hz);
+}
+
+void destroy_frame_pacer(FramePacer * pacer)
+{
+	(void) pacer;
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+}
+
+float pacer_wait(FramePacer * pacer)
+{
+	int64_t now = pacer_now();
+	int64_t sleep = pacer->deadline - pacer->spin - now;
+	if (sleep > 0) {
+		std::this_thread::sleep_for(std::chrono::nanoseconds(sleep));
+	}
+	while ((now = pacer_now()) < pacer->deadline) {
+		std::this_thread::yield();
+	}
+
+	int64_t frame = now - pacer->last;
+	pacer->last = now;
+	pacer->deadline += pacer->period;
+	// More than a frame behind (a hitch, a debugger, a window drag):
+	// start the schedule over instead of rushing out frames to catch up
+	if (pacer->deadline < now) {
+		pacer->deadline = now + pacer->period;
+	}
+
+	histogram_add(&pacer->frames, frame);
+	int64_t error = frame - pacer->period;
+	pacer->total_error += error < 0 ? -error : error;
+	pacer->delta_time = (float) (frame * 1e-9);
+	return pacer->delta_time;
+}
+
+void pacer_report(const FramePacer * pacer, FILE * out)
+{
+	const TimeHistogram * h = &pacer->frames;
+	if (h->count == 0) return;
+	fprintf(out, "%u frames, target %.3f ms: p50 %.2f ms, p99 %.2f ms, "
+		"worst %.2f ms, mean jitter %.3f ms\n",
+		h->count, pacer->period / 1e6,
+		histogram_percentile(h, 0.5), histogram_percentile(h, 0.99),
+		h->worst / 1e6, pacer->total_error / 1e6 / h->count);
+}
+
+void make_latency_meter(LatencyMeter * m)
+{
+	memset(m, 0, sizeof(LatencyMeter));
+}
+
+void latency_event(LatencyMeter * m, int64_t when)
+{
+	if (m->pending_count < LATENCY_MAX_PENDING) {
+		m->pending[m->pending_count++] = when;
+	}
+}
+
+void latency_consumed(LatencyMeter * m, bool consumed)
+{
+	m->consumed = consumed;
+}
+
+void latency_presented(LatencyMeter * m, int64_t now)
+{
+	if (!m->consumed) return;
+	for (int i = 0; i < m->pending_count; i++) {
+		histogram_add(&m->latency, now - m->pending[i]);
+	}
+	m->pending_count = 0;
+	m->consumed = false;
+}
+
+void latency_report(const LatencyMeter * m, FILE * out)
+{
+	const TimeHistogram * h = &m->latency;
+	if (h->count == 0) return;
+	fprintf(out, "%u keys, input to swap: median %.2f ms, p99 %.2f ms, worst %.2f ms\n",
+		h->count, histogram_percentile(h, 0.5), histogram_percentile(h, 0.99),
+		h->worst / 1e6);
+}
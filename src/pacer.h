@@ -0,0 +1,69 @@
+#ifndef NES_PACER_H
+#define NES_PACER_H
+
+// Frame pacer. Holds each frame to an exact period measured against a
+// fixed schedule (so errors don't accumulate), sleeping most of the
+// way and spinning the last stretch, since OS sleeps only promise to
+// wake up *some* time after they're asked to.
+//
+// This only paces presentation; the sim still steps at SIM_DT through
+// its SimClock, however fast or slow frames come.
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Durations are binned in 0.1 ms buckets, the last one catches
+// everything from 50 ms up
+#define PACER_BUCKET_US 100
+#define PACER_BUCKETS   501
+
+struct TimeHistogram {
+	uint32_t count;
+	uint32_t buckets[PACER_BUCKETS];
+	int64_t worst; // ns
+};
+
+void histogram_add(TimeHistogram * h, int64_t ns);
+// Percentile (0-1) in ms, to bucket precision
+double histogram_percentile(const TimeHistogram * h, double p);
+
+struct FramePacer {
+	int64_t period;    // ns
+	int64_t spin;      // ns before a deadline to stop sleeping
+	int64_t deadline;  // ns, when the next frame is due
+	int64_t last;      // ns, when the last frame went out
+	float delta_time;  // seconds between the last two frames
+	TimeHistogram frames;
+	int64_t total_error; // sum of |frame time - period|, ns
+};
+
+int64_t pacer_now();
+void make_frame_pacer(FramePacer * pacer, double hz);
+void destroy_frame_pacer(FramePacer * pacer);
+// Blocks until the next frame is due and returns the seconds since
+// the previous one (also left in delta_time)
+float pacer_wait(FramePacer * pacer);
+void pacer_report(const FramePacer * pacer, FILE * out);
+
+// Input latency: how long from a key event to the swap of the first
+// frame that reflects it. Events are stamped when they arrive, then
+// resolved in one go once the sim has consumed them and the frame is
+// on its way out.
+#define LATENCY_MAX_PENDING 16
+
+struct LatencyMeter {
+	int pending_count;
+	int64_t pending[LATENCY_MAX_PENDING];
+	bool consumed;
+	TimeHistogram latency;
+};
+
+void make_latency_meter(LatencyMeter * m);
+void latency_event(LatencyMeter * m, int64_t when);
+// Call after updating, with whether the sim took this frame's input
+void latency_consumed(LatencyMeter * m, bool consumed);
+// Call right after the swap
+void latency_presented(LatencyMeter * m, int64_t now);
+void latency_report(const LatencyMeter * m, FILE * out);
+
+#endif
@@ -0,0 +1,50 @@
+// Offline level-pack writer (see levelpack.h).
+//
+//   bin/levelpack <out.pack> <count> [seed] [--hops]
+//
+// --hops stores every level's next-hop table too, about 10 KB a level,
+// so sims routing ghosts off one don't rebuild it on each level switch.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "levelpack.h"
+
+int main(int argc, char ** argv)
+{
+	uint32_t flags = 0;
+	const char * args[3];
+	int arg_count = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--hops") == 0) {
+			flags |= PACK_HOPS;
+		} else if (arg_count < 3) {
+			args[arg_count++] = argv[i];
+		}
+	}
+	if (arg_count < 2) {
+		printf("usage: %s <out.pack> <count> [seed] [--hops]\n", argv[0]);
+		return 1;
+	}
+	int count = atoi(args[1]);
+	uint32_t seed = arg_count > 2 ? (uint32_t) strtoul(args[2], NULL, 10) : 1;
+	if (count <= 0) {
+		printf("Level count must be positive\n");
+		return 1;
+	}
+	if (!write_level_pack(args[0], count, seed, flags)) {
+		printf("Couldn't write %s\n", args[0]);
+		return 1;
+	}
+	LevelPack pack;
+	if (!open_level_pack(&pack, args[0])) {
+		printf("Wrote %s but couldn't read it back\n", args[0]);
+		return 1;
+	}
+	printf("%u levels (%u starting top-left), %zu bytes, checksum %08x\n",
+		pack.header.level_count, pack.header.top_left_count,
+		pack.size, pack.header.checksum);
+	close_level_pack(&pack);
+	return 0;
+}
@@ -0,0 +1,126 @@
+#include "pool.h"
+
+static bool pop_own(PoolQueue * q, PoolTask * task)
+{
+	std::lock_guard<std::mutex> guard(q->lock);
+	if (q->tasks.empty()) return false;
+	*task = q->tasks.back();
+	q->tasks.pop_back();
+	return true;
+}
+
+static bool steal(PoolQueue * q, PoolTask * task)
+{
+	std::lock_guard<std::mutex> guard(q->lock);
+	if (q->tasks.empty()) return false;
+	*task = q->tasks.front();
+	q->tasks.pop_front();
+	return true;
+}
+
+// Own queue first, then everyone else's starting from our neighbour
+// so thieves don't all pile onto queue 0.
+static bool find_task(Pool * pool, int self, PoolTask * task)
+{
+	int queue_count = pool->worker_count + 1;
+	bool found = pop_own(pool->queues + self, task);
+	for (int i = 1; !found && i < queue_count; i++) {
+		found = steal(pool->queues + (self + i) % queue_count, task);
+	}
+	if (found) pool->queued.fetch_sub(1);
+	return found;
+}
+
+static void run_task(PoolTask task)
+{
+	for (int i = task.begin; i < task.end; i++) {
+		task.job->func(task.job->data, i);
+	}
+	task.job->remaining.fetch_sub(1, std::memory_order_release);
+}
+
+static void worker_loop(Pool * pool, int self)
+{
+	while (pool->running.load()) {
+		PoolTask task;
+		if (find_task(pool, self, &task)) {
+			run_task(task);
+			continue;
+		}
+		std::unique_lock<std::mutex> guard(pool->sleep_lock);
+		pool->wake.wait(guard, [pool] {
+			return pool->queued.load() > 0 || !pool->running.load();
+		});
+	}
+}
+
+void make_pool(Pool * pool, int worker_count)
+{
+	if (worker_count <= 0) {
+		worker_count = (int) std::thread::hardware_concurrency() - 1;
+		if (worker_count < 0) worker_count = 0;
+	}
+	pool->worker_count = worker_count;
+	pool->queues = new PoolQueue[worker_count + 1];
+	pool->queued = 0;
+	pool->running = true;
+	pool->workers = new std::thread[worker_count];
+	for (int i = 0; i < worker_count; i++) {
+		pool->workers[i] = std::thread(worker_loop, pool, i);
+	}
+}
+
+void destroy_pool(Pool * pool)
+{
+	{
+		std::lock_guard<std::mutex> guard(pool->sleep_lock);
+		pool->running = false;
+	}
+	pool->wake.notify_all();
+	for (int i = 0; i < pool->worker_count; i++) {
+		pool->workers[i].join();
+	}
+	delete[] pool->workers;
+	delete[] pool->queues;
+}
+
+void pool_for(Pool * pool, int count, PoolFunc func, void * data)
+{
+	if (count <= 0) return;
+	int queue_count = pool->worker_count + 1;
+	// A few chunks per queue gives stealing something to balance
+	// with, without paying a lock per index.
+	int chunks = queue_count * 4;
+	if (chunks > count) chunks = count;
+
+	PoolJob job;
+	job.func = func;
+	job.data = data;
+	job.remaining = chunks;
+	// Counted before they're pushed, so a worker that grabs one early
+	// can't take queued below zero
+	{
+		std::lock_guard<std::mutex> guard(pool->sleep_lock);
+		pool->queued += chunks;
+	}
+	for (int c = 0; c < chunks; c++) {
+		PoolTask task;
+		task.job   = &job;
+		task.begin = (int) ((long long) count * c / chunks);
+		task.end   = (int) ((long long) count * (c + 1) / chunks);
+		PoolQueue * q = pool->queues + c % queue_count;
+		std::lock_guard<std::mutex> guard(q->lock);
+		q->tasks.push_back(task);
+	}
+	pool->wake.notify_all();
+
+	int self = pool->worker_count;
+	while (job.remaining.load(std::memory_order_acquire) > 0) {
+		PoolTask task;
+		if (find_task(pool, self, &task)) {
+			run_task(task);
+		} else {
+			std::this_thread::yield();
+		}
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef NES_POOL_H
+#define NES_POOL_H
+
+// Work-stealing thread pool. Each worker owns a deque of tasks; it
+// pops from the back of its own and steals from the front of the
+// others when it runs dry. The thread calling pool_for() pitches in
+// too, so a pool of N workers keeps N+1 cores busy.
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+typedef void (*PoolFunc)(void * data, int index);
+
+struct PoolJob {
+	PoolFunc func;
+	void * data;
+	std::atomic<int> remaining;
+};
+
+struct PoolTask {
+	PoolJob * job;
+	int begin;
+	int end;
+};
+
+struct PoolQueue {
+	std::mutex lock;
+	std::deque<PoolTask> tasks;
+};
+
+struct Pool {
+	int worker_count;
+	std::thread * workers;
+	// One queue per worker, plus one for the calling thread at the end
+	PoolQueue * queues;
+	std::mutex sleep_lock;
+	std::condition_variable wake;
+	// Tasks pushed but not yet taken by anyone; idle workers sleep
+	// until it's nonzero
+	std::atomic<int> queued;
+	std::atomic<bool> running;
+};
+
+// worker_count <= 0 means one worker per core, minus the caller
+void make_pool(Pool * pool, int worker_count);
+void destroy_pool(Pool * pool);
+
+// Calls func(data, i) for every i in [0, count) and returns once all
+// of them have finished.
+void pool_for(Pool * pool, int count, PoolFunc func, void * data);
+
+#endif
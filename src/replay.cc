@@ -0,0 +1,169 @@
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "levelpack.h"
+#include "replay.h"
+
+bool make_recorder(Recorder * r, const char * path, const Sim * sim, float dt)
+{
+	r->file = fopen(path, "wb");
+	if (!r->file) return false;
+	r->header.magic = REPLAY_MAGIC;
+	r->header.version = REPLAY_VERSION;
+	r->header.seed = sim->seed;
+	r->header.dt = dt;
+	r->header.frame_count = 0;
+	r->header.event_count = 0;
+	r->header.flags = sim->flags;
+	r->header.pack_checksum = sim->pack ? sim->pack->header.checksum : 0;
+	r->last_frame = 0;
+	// Placeholder, patched in close_recorder
+	fwrite(&r->header, sizeof(ReplayHeader), 1, r->file);
+	return true;
+}
+
+void recorder_push(Recorder * r, uint32_t frame, Input input)
+{
+	for (int i = 0; i < input.key_count; i++) {
+		uint8_t buf[6];
+		int len = 0;
+		uint32_t delta = frame - r->last_frame;
+		do {
+			uint8_t b = delta & 0x7F;
+			delta >>= 7;
+			buf[len++] = b | (delta ? 0x80 : 0);
+		} while (delta);
+		buf[len++] = (uint8_t) input.keys[i];
+		fwrite(buf, 1, len, r->file);
+		r->last_frame = frame;
+		r->header.event_count++;
+	}
+}
+
+void close_recorder(Recorder * r, uint32_t frame_count)
+{
+	r->header.frame_count = frame_count;
+	fseek(r->file, 0, SEEK_SET);
+	fwrite(&r->header, sizeof(ReplayHeader), 1, r->file);
+	fclose(r->file);
+	r->file = NULL;
+}
+
+static void decode_next_frame(Replay * r)
+{
+	uint32_t delta = 0;
+	int shift = 0;
+	while (r->cursor < r->end) {
+		uint8_t b = *r->cursor++;
+		delta |= (uint32_t) (b & 0x7F) << shift;
+		shift += 7;
+		if (!(b & 0x80)) break;
+	}
+	r->next_frame += delta;
+}
+
+bool open_replay(Replay * r, const char * path)
+{
+	memset(r, 0, sizeof(Replay));
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+	r->data = (const uint8_t*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	r->size = (size_t) size.QuadPart;
+	r->mapping = mapping;
+	r->file = file;
+	if (!r->data) {
+		close_replay(r);
+		return false;
+	}
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	fstat(fd, &st);
+	r->size = st.st_size;
+	void * data = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return false;
+	// Playback reads it front to back exactly once
+	madvise(data, r->size, MADV_SEQUENTIAL);
+	r->data = (const uint8_t*) data;
+#endif
+	if (r->size < sizeof(ReplayHeader)) {
+		close_replay(r);
+		return false;
+	}
+	memcpy(&r->header, r->data, sizeof(ReplayHeader));
+	if (r->header.magic != REPLAY_MAGIC || r->header.version != REPLAY_VERSION) {
+		close_replay(r);
+		return false;
+	}
+	r->cursor = r->data + sizeof(ReplayHeader);
+	r->end = r->data + r->size;
+	r->next_frame = 0;
+	if (r->cursor < r->end) decode_next_frame(r);
+	return true;
+}
+
+void close_replay(Replay * r)
+{
+#ifdef _WIN32
+	if (r->data) UnmapViewOfFile(r->data);
+	if (r->mapping) CloseHandle((HANDLE) r->mapping);
+	if (r->file) CloseHandle((HANDLE) r->file);
+#else
+	if (r->data) munmap((void*) r->data, r->size);
+#endif
+	memset(r, 0, sizeof(Replay));
+}
+
+void replay_input(Replay * r, uint32_t frame, Input * input)
+{
+	input->key_count = 0;
+	// next_frame is only meaningful while there's a key byte after it
+	while (r->cursor < r->end && r->next_frame <= frame) {
+		input_push(input, (Key) *r->cursor++);
+		if (r->cursor < r->end) decode_next_frame(r);
+	}
+}
+
+bool replay_wants_pack(const Replay * r, const LevelPack * pack)
+{
+	return r->header.pack_checksum == (pack ? pack->header.checksum : 0);
+}
+
+uint64_t run_replay(Replay * r, Sim * sim, const LevelPack * pack, AudioSink * sink)
+{
+	make_sim(sim, r->header.seed);
+	sim->flags = r->header.flags;
+	sim_use_level_pack(sim, pack);
+	SoundQueue sounds;
+	if (sink) {
+		make_sound_queue(&sounds);
+		sim->sounds = &sounds;
+	}
+	Input input;
+	for (uint32_t f = 0; f < r->header.frame_count; f++) {
+		replay_input(r, f, &input);
+		step(sim, input, r->header.dt);
+		if (sink) audio_drain(&sounds, sink);
+	}
+	sim->sounds = NULL;
+	return sim_hash(sim);
+}
@@ -0,0 +1,84 @@
+#ifndef NES_REPLAY_H
+#define NES_REPLAY_H
+
+// Input recording and playback. A recording is the seed and timestep
+// plus every key the simulation consumed, tagged with the frame it was
+// applied on. Since the simulation is deterministic, that's enough to
+// play the whole session back.
+//
+// File layout, all little-endian:
+//   ReplayHeader
+//   events: LEB128 varint frame delta from the previous event,
+//           then one byte of Key
+// Most events cost two bytes.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sim.h"
+#include "audio.h"
+
+#define REPLAY_MAGIC   0x5253454E // "NESR"
+// Bumped whenever the rules or the header change enough that older
+// recordings wouldn't play back the same; those are refused rather
+// than replayed wrong.
+#define REPLAY_VERSION 2
+
+struct ReplayHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seed;
+	float dt;
+	// Number of frames recorded, so playback knows when to stop even
+	// if the last few had no input
+	uint32_t frame_count;
+	uint32_t event_count;
+	// Sim::flags the game was played with
+	uint32_t flags;
+	// PackHeader::checksum of the level pack it was played on, 0 if
+	// the levels were generated
+	uint32_t pack_checksum;
+};
+
+struct Recorder {
+	FILE * file;
+	ReplayHeader header;
+	uint32_t last_frame;
+};
+
+// Starts recording a freshly made sim (frame 0), after its flags are set
+bool make_recorder(Recorder * r, const char * path, const Sim * sim, float dt);
+void recorder_push(Recorder * r, uint32_t frame, Input input);
+// Patches the header and closes the file
+void close_recorder(Recorder * r, uint32_t frame_count);
+
+struct Replay {
+	ReplayHeader header;
+	const uint8_t * data;
+	size_t size;
+	const uint8_t * cursor;
+	const uint8_t * end;
+	uint32_t next_frame; // frame of the next undecoded event
+	void * mapping;      // platform handles
+	void * file;
+};
+
+// Maps the file into memory; nothing is copied or parsed up front
+bool open_replay(Replay * r, const char * path);
+void close_replay(Replay * r);
+// Fills input with the keys recorded for frame. Frames must be asked
+// for in increasing order.
+void replay_input(Replay * r, uint32_t frame, Input * input);
+// Plays the whole recording into sim (which gets re-made from the
+// recorded seed) as fast as possible, and returns sim_hash of the end
+// state. A recording made on a level pack needs that pack passed in
+// (see replay_wants_pack). If sink is given, the game's sounds are
+// drained into it every frame.
+uint64_t run_replay(
+	Replay * r, Sim * sim, const LevelPack * pack = NULL, AudioSink * sink = NULL);
+// Whether pack (or NULL, for generated levels) is the one r was
+// recorded on
+bool replay_wants_pack(const Replay * r, const LevelPack * pack);
+
+#endif
@@ -0,0 +1,88 @@
+// Headless replay player: runs a recording through the simulation as
+// fast as the CPU allows and prints the end-state hash, so the same
+// session can be compared (and timed) before and after a change.
+//
+//   bin/replay [--pack <levels.pack>] <recording> [repeat]
+//
+// Recordings made on a level pack need the same pack to play back.
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "levelpack.h"
+#include "replay.h"
+
+int main(int argc, char ** argv)
+{
+	const char * pack_path = NULL;
+	if (argc > 2 && strcmp(argv[1], "--pack") == 0) {
+		pack_path = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 2) {
+		printf("usage: %s [--pack <levels.pack>] <recording> [repeat]\n", argv[0]);
+		return 1;
+	}
+	int repeat = argc > 2 ? atoi(argv[2]) : 1;
+	if (repeat < 1) repeat = 1;
+	LevelPack pack;
+	if (pack_path && !open_level_pack(&pack, pack_path)) {
+		printf("Couldn't open level pack %s\n", pack_path);
+		return 1;
+	}
+
+	uint64_t hash = 0;
+	uint32_t seed = 0;
+	uint32_t frames = 0;
+	uint32_t events = 0;
+	AudioSink sink;
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < repeat; i++) {
+		Replay replay;
+		if (!open_replay(&replay, argv[1])) {
+			printf("Couldn't open replay %s\n", argv[1]);
+			return 1;
+		}
+		if (!replay_wants_pack(&replay, pack_path ? &pack : NULL)) {
+			if (!replay.header.pack_checksum) {
+				printf("%s was recorded without a level pack\n", argv[1]);
+			} else if (!pack_path) {
+				printf("%s was recorded on a level pack, pass it with --pack\n", argv[1]);
+			} else {
+				printf("%s was recorded on a different level pack\n", argv[1]);
+			}
+			return 1;
+		}
+		Sim sim;
+		// Null sink: no audio device, the sounds only get counted
+		make_audio_sink(&sink);
+		uint64_t h = run_replay(&replay, &sim, pack_path ? &pack : NULL, &sink);
+		if (i > 0 && h != hash) {
+			printf("Run %d diverged: %016llx vs %016llx\n", i,
+				(unsigned long long) h, (unsigned long long) hash);
+			return 1;
+		}
+		hash = h;
+		seed = replay.header.seed;
+		frames = replay.header.frame_count;
+		events = replay.header.event_count;
+		destroy_sim(&sim);
+		close_replay(&replay);
+	}
+	if (pack_path) close_level_pack(&pack);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	printf("seed %u, %u frames, %u key events\n", seed, frames, events);
+	printf("sounds: %llu player deaths, %llu ghost deaths, %llu crystals, %llu wins\n",
+		(unsigned long long) sink.counts[SOUND_PLAYER_DEATH],
+		(unsigned long long) sink.counts[SOUND_GHOST_DEATH],
+		(unsigned long long) sink.counts[SOUND_CRYSTAL_GRAB],
+		(unsigned long long) sink.counts[SOUND_WON_GAME]);
+	printf("end state %016llx\n", (unsigned long long) hash);
+	printf("%.3f ms per playback, %.0f frames/s\n",
+		seconds * 1000 / repeat, (double) frames * repeat / seconds);
+	return 0;
+}
@@ -0,0 +1,857 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "sim.h"
+#include "audio.h"
+#include "levelpack.h"
+#include "replay.h"
+#include "trace.h"
+
+#define SQR(x) ((x) * (x))
+
+static const Vector2i directions[] = {
+	{+0, -1}, // UP
+	{-1, +0}, // LEFT
+	{+0, +1}, // DOWN
+	{+1, +0}, // RIGHT
+};
+
+static void push_event(Sim * sim, SoundEvent e)
+{
+	if (sim->sounds) sound_queue_push(sim->sounds, e);
+}
+
+void make_entity(Entity * e, Vector2i pos, Texture tex)
+{
+	e->pos = Vector2i(pos.x * 16, pos.y * 16);
+	e->grid_pos = pos;
+	e->target_pos = pos;
+	e->move_t = 0;
+	e->move_div = 0.3;
+	e->tex = tex;
+	e->moving = false;
+	e->visible = true;
+	e->type = ENTITY;
+}
+
+void move_entity(Entity * e, Vector2i from, Vector2i target, float dt)
+{
+	if (target.x == from.x && target.y == from.y) return;
+	e->moving = true;
+	e->move_t += dt;
+	float t = e->move_t / e->move_div;
+	e->pos.x = (from.x * 16) + t * ((target.x - from.x) * 16);
+	e->pos.y = (from.y * 16) + t * ((target.y - from.y) * 16);
+	if (t >= 1) {
+		e->move_t = 0;
+		e->moving = false;
+		e->grid_pos = target;
+		e->pos.x = e->grid_pos.x * 16;
+		e->pos.y = e->grid_pos.y * 16;
+	}
+}
+
+void make_player(Player * p, Vector2i pos, int power_level)
+{
+	Texture tex;
+	tex.pos = Vector2i(32 + (16 * power_level), 16);
+	tex.dim = Vector2i(16, 16);
+	tex.scale = Vector2f(1, 1);
+	make_entity(p, pos, tex);
+	p->power_level = power_level;
+	p->power_max   = power_level;
+	p->direction = Vector2i(0, 0);
+	p->queued_direction = Vector2i(0, 0);
+	p->move_from = pos;
+	p->death_timer = 0;
+	p->flash_timer = 0;
+	p->type = PLAYER;
+}
+
+bool update_player(Sim * sim, float dt)
+{
+	TRACE_SCOPE("update_player");
+	Player * p = &sim->player;
+	if (sim->game_state == GAME_LOSS) {
+		p->death_timer -= dt;
+		p->flash_timer -= dt;
+		if (p->flash_timer <= 0) {
+			p->visible = !p->visible;
+			p->flash_timer = PLAYER_FLASH_TIMER_RESET;
+		}
+		return p->death_timer <= 0;
+	}
+	p->tex.pos = Vector2i(48 + (16 * p->power_level), 16);
+	bool pre_turn = sim->flags & SIM_PRE_TURN;
+	if (!p->moving) {
+		if (level_open(&sim->level, p->grid_pos + p->queued_direction)) {
+			p->direction = p->queued_direction;
+		} else if (pre_turn && level_open(&sim->level, p->grid_pos + p->direction)) {
+			// Keep going, the turn waits for a tile it fits
+		} else {
+			p->direction = Vector2i(0, 0);
+		}
+		p->move_from = p->grid_pos;
+	} else if (pre_turn &&
+		p->queued_direction.x == -p->direction.x &&
+		p->queued_direction.y == -p->direction.y) {
+		// Turn around on the spot: swap the ends of the move, as far
+		// along as we were. grid_pos stays put, since the tile we
+		// were heading for was never reached.
+		p->move_from = p->move_from + p->direction;
+		p->direction = p->queued_direction;
+		p->move_t = p->move_div - p->move_t;
+	}
+	move_entity(p, p->move_from, p->move_from + p->direction, dt);
+	return false;
+}
+
+void keydown_player(Player * p, Key key)
+{
+	switch (key) {
+	case KEY_UP: {
+		p->queued_direction = Vector2i(+0, -1);
+	} break;
+	case KEY_LEFT: {
+		p->queued_direction = Vector2i(-1, +0);
+	} break;
+	case KEY_DOWN: {
+		p->queued_direction = Vector2i(+0, +1);
+	} break;
+	case KEY_RIGHT: {
+		p->queued_direction = Vector2i(+1, +0);
+	} break;
+	case KEY_POWER_DOWN: {
+		if (p->power_level > 0) {
+			p->power_level--;
+		}
+	} break;
+	case KEY_POWER_UP: {
+		if (p->power_level < p->power_max) {
+			p->power_level++;
+		}
+	} break;
+	case KEY_POWER_MAX_UP: {
+		p->power_max++;
+	} break;
+	case KEY_POWER_MAX_DOWN: {
+		p->power_max--;
+	} break;
+	}
+}
+
+int add_ghost(Sim * sim, Vector2i pos, int power_type, float move_div)
+{
+	Ghosts * gs = &sim->ghosts;
+	if (gs->count == SIM_MAX_GHOSTS) return -1;
+	int id = bitboard_ctz(~gs->live);
+	int i = gs->count++;
+	gs->pos_x[i] = pos.x * 16;
+	gs->pos_y[i] = pos.y * 16;
+	gs->grid_x[i] = pos.x;
+	gs->grid_y[i] = pos.y;
+	gs->dir_x[i] = 0;
+	gs->dir_y[i] = 0;
+	gs->move_t[i] = 0;
+	gs->move_div[i] = move_div;
+	gs->moving[i] = 0;
+	gs->state[i] = GHOST_ALIVE;
+	gs->id[i] = id;
+	gs->power_type[i] = power_type;
+	gs->death_timer[i] = 0;
+	gs->flash_timer[i] = 0;
+	gs->visible[i] = true;
+	gs->tex_pos[i] = Vector2i(48 + (16 * power_type), 32);
+	gs->live |= 1ull << id;
+	gs->slot[id] = i;
+	sim->occupancy.cells[to_index(pos)] |= 1ull << id;
+	return id;
+}
+
+static void remove_ghost(Sim * sim, int i)
+{
+	Ghosts * gs = &sim->ghosts;
+	int id = gs->id[i];
+	sim->occupancy.cells[to_index(gs->grid_x[i], gs->grid_y[i])] &= ~(1ull << id);
+	gs->live &= ~(1ull << id);
+	int last = --gs->count;
+	if (i != last) {
+		gs->pos_x[i] = gs->pos_x[last];
+		gs->pos_y[i] = gs->pos_y[last];
+		gs->grid_x[i] = gs->grid_x[last];
+		gs->grid_y[i] = gs->grid_y[last];
+		gs->dir_x[i] = gs->dir_x[last];
+		gs->dir_y[i] = gs->dir_y[last];
+		gs->move_t[i] = gs->move_t[last];
+		gs->move_div[i] = gs->move_div[last];
+		gs->moving[i] = gs->moving[last];
+		gs->state[i] = gs->state[last];
+		gs->id[i] = gs->id[last];
+		gs->power_type[i] = gs->power_type[last];
+		gs->death_timer[i] = gs->death_timer[last];
+		gs->flash_timer[i] = gs->flash_timer[last];
+		gs->visible[i] = gs->visible[last];
+		gs->tex_pos[i] = gs->tex_pos[last];
+		gs->slot[gs->id[i]] = i;
+	}
+}
+
+void update_flow_field(FlowField * flow, const Level * level, Vector2i target)
+{
+	if (flow->generation == level->generation &&
+		flow->target.x == target.x && flow->target.y == target.y) {
+		return;
+	}
+	TRACE_SCOPE("update_flow_field");
+	flow->generation = level->generation;
+	flow->target = target;
+	bitboard_bfs16(
+		level->open_rows, Level::play_w, Level::play_h,
+		target.x, target.y, flow->dist, flow->next);
+}
+
+// Picks a direction for ghost i if it's between tiles. Returns true
+// once a dead ghost has finished flashing and should go.
+static bool update_ghost(Sim * sim, int i, float dt)
+{
+	Ghosts * gs = &sim->ghosts;
+	TRACE_SCOPE_ARG("update_ghost", gs->id[i]);
+	if (gs->state[i] == GHOST_DEAD) {
+		gs->death_timer[i] -= dt;
+		gs->flash_timer[i] -= dt;
+		if (gs->flash_timer[i] <= 0) {
+			gs->visible[i] = !gs->visible[i];
+			gs->flash_timer[i] = GHOST_FLASH_TIMER_RESET;
+		}
+		return gs->death_timer[i] <= 0;
+	}
+	if (gs->moving[i]) return false;
+	Vector2i grid_pos = ghost_grid_pos(gs, i);
+	int next;
+	if (sim->hops && sim->hops->valid) {
+		next = next_hop(sim->hops, to_index(grid_pos), to_index(sim->player.grid_pos));
+	} else {
+		next = sim->flow.next[to_index(grid_pos)];
+		if (next == FLOW_NONE) next = -1;
+	}
+	if (next == -1) {
+		gs->dir_x[i] = 0;
+		gs->dir_y[i] = 0;
+		return false;
+	}
+	// Every other ghost sharing our cell gets turned around, up to
+	// the first one (by id) found standing where we're headed, which
+	// blocks us.
+	Occupancy * o = &sim->occupancy;
+	uint64_t self = 1ull << gs->id[i];
+	uint64_t ahead = o->cells[to_index(grid_pos.x + gs->dir_x[i], grid_pos.y + gs->dir_y[i])] & ~self;
+	uint64_t here = o->cells[to_index(grid_pos)] & ~self;
+	if (ahead) here &= (ahead & -ahead) - 1;
+	// Kluge Central Station is coming up on your right
+	while (here) {
+		int other = gs->slot[bitboard_ctz(here)];
+		here &= here - 1;
+		gs->dir_x[other] *= -1;
+		gs->dir_y[other] *= -1;
+	}
+	if (ahead) {
+		gs->dir_x[i] = 0;
+		gs->dir_y[i] = 0;
+	} else {
+		gs->dir_x[i] = directions[next].x;
+		gs->dir_y[i] = directions[next].y;
+	}
+	return false;
+}
+
+// move_entity for ghost i
+static inline bool move_ghost(Ghosts * gs, int i, float dt)
+{
+	if (gs->state[i] != GHOST_ALIVE || (gs->dir_x[i] == 0 && gs->dir_y[i] == 0)) {
+		return false;
+	}
+	gs->move_t[i] += dt;
+	float t = gs->move_t[i] / gs->move_div[i];
+	if (t >= 1) {
+		gs->move_t[i] = 0;
+		gs->moving[i] = 0;
+		gs->grid_x[i] += gs->dir_x[i];
+		gs->grid_y[i] += gs->dir_y[i];
+		gs->pos_x[i] = gs->grid_x[i] * 16;
+		gs->pos_y[i] = gs->grid_y[i] * 16;
+		return true;
+	}
+	gs->moving[i] = 1;
+	gs->pos_x[i] = (gs->grid_x[i] * 16) + t * (gs->dir_x[i] * 16);
+	gs->pos_y[i] = (gs->grid_y[i] * 16) + t * (gs->dir_y[i] * 16);
+	return false;
+}
+
+// Steps every live ghost along its direction, four at a time. Same
+// arithmetic as move_ghost, so both paths land on the same pixels.
+// Returns a bit per (dense) index for the ghosts that reached a new
+// cell.
+static uint64_t move_ghosts(Ghosts * gs, float dt)
+{
+	uint64_t arrived = 0;
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 one = _mm_set1_ps(1);
+	const __m128 step = _mm_set1_ps(dt);
+	for (; i + 4 <= gs->count; i += 4) {
+		__m128i dx = _mm_loadu_si128((const __m128i*) (gs->dir_x + i));
+		__m128i dy = _mm_loadu_si128((const __m128i*) (gs->dir_y + i));
+		__m128i still = _mm_cmpeq_epi32(_mm_or_si128(dx, dy), zero);
+		__m128i alive = _mm_cmpeq_epi32(
+			_mm_loadu_si128((const __m128i*) (gs->state + i)), _mm_set1_epi32(GHOST_ALIVE));
+		__m128i active = _mm_andnot_si128(still, alive);
+		int active_bits = _mm_movemask_ps(_mm_castsi128_ps(active));
+		if (!active_bits) continue;
+
+		__m128 move_t = _mm_add_ps(_mm_loadu_ps(gs->move_t + i), step);
+		__m128 t = _mm_div_ps(move_t, _mm_loadu_ps(gs->move_div + i));
+		__m128i done = _mm_castps_si128(_mm_cmpge_ps(t, one));
+		__m128i gx = _mm_loadu_si128((const __m128i*) (gs->grid_x + i));
+		__m128i gy = _mm_loadu_si128((const __m128i*) (gs->grid_y + i));
+
+		// Mid-move
+		__m128i px = _mm_cvttps_epi32(_mm_add_ps(
+			_mm_cvtepi32_ps(_mm_slli_epi32(gx, 4)),
+			_mm_mul_ps(t, _mm_cvtepi32_ps(_mm_slli_epi32(dx, 4)))));
+		__m128i py = _mm_cvttps_epi32(_mm_add_ps(
+			_mm_cvtepi32_ps(_mm_slli_epi32(gy, 4)),
+			_mm_mul_ps(t, _mm_cvtepi32_ps(_mm_slli_epi32(dy, 4)))));
+		// Arrived: snap to the next cell
+		__m128i ngx = _mm_add_epi32(gx, _mm_and_si128(done, dx));
+		__m128i ngy = _mm_add_epi32(gy, _mm_and_si128(done, dy));
+		px = _mm_or_si128(_mm_and_si128(done, _mm_slli_epi32(ngx, 4)), _mm_andnot_si128(done, px));
+		py = _mm_or_si128(_mm_and_si128(done, _mm_slli_epi32(ngy, 4)), _mm_andnot_si128(done, py));
+		move_t = _mm_andnot_ps(_mm_castsi128_ps(done), move_t);
+		__m128i moving = _mm_andnot_si128(done, _mm_set1_epi32(1));
+
+		#define MASKED_STORE(field, v) do {                                    \
+			__m128i old = _mm_loadu_si128((const __m128i*) (gs->field + i));  \
+			_mm_storeu_si128((__m128i*) (gs->field + i),                      \
+				_mm_or_si128(_mm_and_si128(active, (v)), _mm_andnot_si128(active, old))); \
+		} while (0)
+		MASKED_STORE(pos_x, px);
+		MASKED_STORE(pos_y, py);
+		MASKED_STORE(grid_x, ngx);
+		MASKED_STORE(grid_y, ngy);
+		MASKED_STORE(moving, moving);
+		MASKED_STORE(move_t, _mm_castps_si128(move_t));
+		#undef MASKED_STORE
+
+		arrived |= (uint64_t) _mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(active, done))) << i;
+	}
+#endif
+	for (; i < gs->count; i++) {
+		if (move_ghost(gs, i, dt)) arrived |= 1ull << i;
+	}
+	return arrived;
+}
+
+void update_ghosts(Sim * sim, float dt)
+{
+	Ghosts * gs = &sim->ghosts;
+	// Decisions go in id order, since a ghost can turn around the
+	// ones it shares a cell with. Walking ids rather than indices also
+	// means the ghost swapped into a removed one's slot still gets its
+	// turn.
+	uint64_t ids = gs->live;
+	while (ids) {
+		int id = bitboard_ctz(ids);
+		ids &= ids - 1;
+		if (update_ghost(sim, gs->slot[id], dt)) {
+			remove_ghost(sim, gs->slot[id]);
+		}
+	}
+	uint64_t arrived = move_ghosts(gs, dt);
+	while (arrived) {
+		int i = bitboard_ctz(arrived);
+		arrived &= arrived - 1;
+		uint64_t bit = 1ull << gs->id[i];
+		sim->occupancy.cells[to_index(gs->grid_x[i] - gs->dir_x[i], gs->grid_y[i] - gs->dir_y[i])] &= ~bit;
+		sim->occupancy.cells[to_index(gs->grid_x[i], gs->grid_y[i])] |= bit;
+	}
+}
+
+void kill_ghost(Sim * sim, int i)
+{
+	Ghosts * gs = &sim->ghosts;
+	if (gs->state[i] == GHOST_DEAD) return;
+	gs->state[i] = GHOST_DEAD;
+	push_event(sim, SOUND_GHOST_DEATH);
+	// TODO(pixlark): Not very robust, if we want to make the ghost
+	// alive again, then we have to set the texture position
+	// again. But on the other hand, this time it's a one-time
+	// operation rather than an extra if-statement every
+	// frame. Probably doesn't matter either way but worth thinking
+	// about.
+	gs->tex_pos[i].y = 48;
+	gs->death_timer[i] = GHOST_DEATH_TIMER_RESET;
+	gs->flash_timer[i] = GHOST_FLASH_TIMER_RESET;
+}
+
+void carve_maze(
+	int * grid, int width, int height, Vector2i start, Rng * rng,
+	int * frontier, uint64_t * queued)
+{
+	// Border cells start out marked as queued, so they never get
+	// queued for real and nothing has to bounds check. Everything
+	// queued is interior, so all four of its neighbours exist.
+	memset(queued, 0, sizeof(uint64_t) * ((width * height + 63) / 64));
+	auto mark = [queued](int i) {
+		queued[i >> 6] |= 1ull << (i & 63);
+	};
+	for (int x = 0; x < width; x++) {
+		mark(to_index(x, 0, width));
+		mark(to_index(x, height - 1, width));
+	}
+	for (int y = 0; y < height; y++) {
+		mark(to_index(0, y, width));
+		mark(to_index(width - 1, y, width));
+	}
+	const int neighbours[4] = {-width, -1, +width, +1}; // UP, LEFT, DOWN, RIGHT
+	int len = 0;
+	// Queues the walls around c that aren't queued yet, if enable.
+	// Branch-free: which walls qualify is a coin flip, and guessing
+	// wrong costs more than the always-store.
+	auto add_walls = [&](int c, int enable) {
+		for (int i = 0; i < 4; i++) {
+			int n = c + neighbours[i];
+			int fresh = enable & (grid[n] != 0) & !((queued[n >> 6] >> (n & 63)) & 1);
+			queued[n >> 6] |= (uint64_t) fresh << (n & 63);
+			frontier[len] = n;
+			len += fresh;
+		}
+	};
+	int s = to_index(start, width);
+	grid[s] = 0;
+	add_walls(s, 1);
+	while (len > 0) {
+		int wi = rng_range(rng, len);
+		int w = frontier[wi];
+		frontier[wi] = frontier[--len];
+		queued[w >> 6] &= ~(1ull << (w & 63));
+		int bordering = !grid[w - 1] + !grid[w + 1] + !grid[w - width] + !grid[w + width];
+		int open = bordering == 1;
+		grid[w] &= open - 1;
+		add_walls(w, open);
+	}
+}
+
+void generate_level(Level * level, Rng * rng, NextHopTable * hops)
+{
+	TRACE_SCOPE_ARG("generate_level", level->generation + 1);
+	Vector2i start;
+	if (level->top_left) {
+		start.x = 1;
+		start.y = 1;
+		level->crystal_pos.x = Level::play_w - 2;
+		level->crystal_pos.y = Level::play_h - 2;
+	} else {
+		start.x = Level::play_w - 2;
+		start.y = Level::play_h - 2;
+		level->crystal_pos.x = 1;
+		level->crystal_pos.y = 1;
+	}
+	for (int i = 0; i < Level::play_w*Level::play_h; i++) level->grid[i] = 1;
+	int frontier[Level::play_w * Level::play_h];
+	uint64_t queued[(Level::play_w * Level::play_h + 63) / 64];
+	carve_maze(level->grid, Level::play_w, Level::play_h, start, rng, frontier, queued);
+	{
+		// Readjust crystal pos
+		Vector2i dir = level->top_left ? Vector2i(-1, -1) : Vector2i(1, 1);
+		while (level->grid[to_index(level->crystal_pos)]) {
+			// TODO(pixlark): This has about a 1/2048 chance (I
+			// think) of failing if the maze generation forms a
+			// perfect diagonal line.
+			level->crystal_pos += dir;
+		}
+	}
+	memset(level->open_rows, 0, sizeof(level->open_rows));
+	bitboard_from_grid(level->open_rows, level->grid, Level::play_w, Level::play_h);
+	level->top_left = !level->top_left;
+	level->generation++;
+	if (hops) {
+		build_next_hop_table(hops, level->grid, Level::play_w, Level::play_h);
+	}
+}
+
+Vector2i get_empty_level_spot(const Level * l, Rng * rng)
+{
+	Vector2i pos;
+	do {
+		pos.x = rng_range(rng, Level::play_w);
+		pos.y = rng_range(rng, Level::play_h);
+	} while (l->grid[to_index(pos)]);
+	return pos;
+}
+
+static const int ghosts_per_level[] = {
+	1, 2, 2, 3,
+	3, 4, 4, 5,
+};
+
+static void clear_ghosts(Sim * sim)
+{
+	sim->ghosts.count = 0;
+	sim->ghosts.live = 0;
+	memset(sim->occupancy.cells, 0, sizeof(sim->occupancy.cells));
+}
+
+void generate_ghosts(Sim * sim, int power)
+{
+	clear_ghosts(sim);
+	// Power -1 is the crystal-less start of a run: no ghosts yet
+	if (power < 0) return;
+	for (int i = 0; i < ghosts_per_level[power]; i++) {
+		Vector2i spot;
+		int power_type;
+		float move_div;
+		do {
+			// Separate statements so the draw order doesn't depend
+			// on argument evaluation order
+			spot = get_empty_level_spot(&sim->level, &sim->rng);
+			power_type = rng_range(&sim->rng, power + 1);
+			move_div = 0.3 + 0.2 * ((float) rng_range(&sim->rng, 100) / 100.0);
+		} while (
+			SQR(MINIMUM_GHOST_DISTANCE) >
+			(SQR(spot.y * 16 - sim->player.pos.y) + SQR(spot.x * 16 - sim->player.pos.x)));
+		add_ghost(sim, spot, power_type, move_div);
+	}
+}
+
+// 5 is the most ghosts_per_level asks for
+static_assert(PACK_SPAWNS >= 5, "packs must hold a spawn per ghost");
+
+// Takes a level starting in the current corner out of the pack, with
+// its ghosts at the pack's spawns. Returns false if the pack has none
+// for this corner.
+static bool reset_pack_level(Sim * sim, int power)
+{
+	const PackHeader * h = &sim->pack->header;
+	int first = sim->level.top_left ? 0 : h->top_left_count;
+	int count = sim->level.top_left ? h->top_left_count : h->level_count - h->top_left_count;
+	if (count == 0) return false;
+	const PackLevel * pl = pack_level(sim->pack, first + rng_range(&sim->rng, count));
+	if (!pl) return false;
+	load_pack_level(sim, sim->pack, pl);
+	clear_ghosts(sim);
+	if (power < 0) return true;
+	for (int i = 0; i < ghosts_per_level[power] && i < pl->spawn_count; i++) {
+		const PackSpawn * s = pl->spawns + i;
+		int power_type = rng_range(&sim->rng, power + 1);
+		float move_div = 0.3 + 0.2 * ((float) s->speed / 100.0);
+		add_ghost(sim, Vector2i(s->x, s->y), power_type, move_div);
+	}
+	return true;
+}
+
+void reset_level(Sim * sim, int power_level)
+{
+	if (sim->pack && reset_pack_level(sim, power_level)) return;
+	// Level generation
+	generate_level(&sim->level, &sim->rng, sim->hops);
+	// Ghost stuff
+	generate_ghosts(sim, power_level);
+}
+
+int check_crystal(Sim * sim)
+{
+	Level  * level  = &sim->level;
+	Player * player = &sim->player;
+	if (player->grid_pos.x == level->crystal_pos.x &&
+		player->grid_pos.y == level->crystal_pos.y) {
+
+		push_event(sim, SOUND_CRYSTAL_GRAB);
+
+		// Player stuff
+		player->power_max++;
+
+		if (player->power_max < 8) {
+			player->power_level = player->power_max;
+			player->grid_pos = level->top_left ? Vector2i(1, 1) : Vector2i(Level::play_w - 2, Level::play_h - 2);
+			player->pos = Vector2i(player->grid_pos.x * 16, player->grid_pos.y * 16);
+			player->move_from = player->grid_pos;
+			player->queued_direction = Vector2i(0, 0);
+			reset_level(sim, player->power_max);
+		} else {
+			push_event(sim, SOUND_WON_GAME);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+bool colliding(Vector2i p0, Vector2i d0, Vector2i p1, Vector2i d1, int buffer)
+{
+	Vector2i bf = Vector2i(buffer, buffer);
+	p0 = p0 + bf;
+	d0 = d0 - bf;
+	p1 = p1 + bf;
+	d1 = d1 - bf;
+	if (p0.x < p1.x + d1.x && p0.x + d0.x > p1.x &&
+		p0.y < p1.y + d1.y && p0.y + d0.y > p1.y) {
+		return true;
+	}
+	return false;
+}
+
+void check_collision(Sim * sim)
+{
+	Player * player = &sim->player;
+	Ghosts * gs = &sim->ghosts;
+	// Hitboxes overlap within 12px on both axes, and every sprite is
+	// less than a tile from its grid_pos, so only ghosts standing
+	// within two cells of the player can touch it.
+	if (gs->count == 0) return;
+	int x0 = player->grid_pos.x > 2 ? player->grid_pos.x - 2 : 0;
+	int y0 = player->grid_pos.y > 2 ? player->grid_pos.y - 2 : 0;
+	int x1 = player->grid_pos.x + 2 < Level::play_w ? player->grid_pos.x + 2 : Level::play_w - 1;
+	int y1 = player->grid_pos.y + 2 < Level::play_h ? player->grid_pos.y + 2 : Level::play_h - 1;
+	uint64_t near = 0;
+	for (int y = y0; y <= y1; y++) {
+		const uint64_t * row = sim->occupancy.cells + to_index(0, y);
+		for (int x = x0; x <= x1; x++) {
+			near |= row[x];
+		}
+	}
+	// Highest id first, as the order kills and deaths get reported in
+	while (near) {
+		int id = 63 - __builtin_clzll(near);
+		near &= ~(1ull << id);
+		int i = gs->slot[id];
+		if (gs->state[i] == GHOST_ALIVE &&
+			colliding(player->pos, player->tex.dim,
+				Vector2i(gs->pos_x[i], gs->pos_y[i]), Vector2i(16, 16), 4)) {
+			if (player->power_level == gs->power_type[i]) {
+				kill_ghost(sim, i);
+			} else if (sim->game_state != GAME_LOSS) {
+				// TODO(pixlark): This should really be somewhere else
+				player->death_timer = PLAYER_DEATH_TIMER_RESET;
+				sim->game_state = GAME_LOSS;
+				push_event(sim, SOUND_PLAYER_DEATH);
+			}
+		}
+	}
+}
+
+void make_sim(Sim * sim, uint32_t seed)
+{
+	sim->game_state = GAME_PLAYING;
+	sim->seed = seed;
+	sim->flags = 0;
+	sim->frame = 0;
+	rng_seed(&sim->rng, seed);
+	make_player(&sim->player, Vector2i(1, 1), -1);
+	sim->level = Level();
+	generate_level(&sim->level, &sim->rng);
+	sim->flow = FlowField();
+	sim->hops = NULL;
+	sim->recorder = NULL;
+	sim->pack = NULL;
+	sim->sounds = NULL;
+	sim->ghosts.count = 0;
+	sim->ghosts.live = 0;
+	memset(&sim->occupancy, 0, sizeof(sim->occupancy));
+}
+
+void destroy_sim(Sim * sim)
+{
+	// Sim owns no memory any more; kept so callers don't need to
+	// know that.
+	(void) sim;
+}
+
+void sim_use_next_hops(Sim * sim, NextHopTable * hops)
+{
+	sim->hops = hops;
+	if (hops) {
+		build_next_hop_table(hops, sim->level.grid, Level::play_w, Level::play_h);
+	}
+}
+
+void sim_use_level_pack(Sim * sim, const LevelPack * pack)
+{
+	sim->pack = pack;
+	if (pack) {
+		sim->level.top_left = true;
+		reset_level(sim, -1);
+	}
+}
+
+void step(Sim * sim, Input input, float dt)
+{
+	TRACE_SCOPE("step");
+	if (sim->recorder && input.key_count > 0) {
+		recorder_push(sim->recorder, sim->frame, input);
+	}
+	sim->frame++;
+	if (sim->game_state == GAME_PLAYING) {
+		for (int i = 0; i < input.key_count; i++) {
+			keydown_player(&sim->player, input.keys[i]);
+		}
+	}
+	if (sim->game_state == GAME_WIN) return;
+	// Player dies
+	if (update_player(sim, dt)) {
+		make_player(&sim->player, Vector2i(1, 1), -1);
+		sim->level.top_left = true; // TODO(pixlark): Klugey way to do it
+		reset_level(sim, -1);
+		sim->game_state = GAME_PLAYING;
+	}
+	// Every ghost chases the same target, so route them all off one
+	// field that's only rebuilt when the player changes cells.
+	if (!sim->hops || !sim->hops->valid) {
+		update_flow_field(&sim->flow, &sim->level, sim->player.grid_pos);
+	}
+	update_ghosts(sim, dt);
+	if (check_crystal(sim)) {
+		sim->game_state = GAME_WIN;
+	}
+	check_collision(sim);
+}
+
+int sim_advance(Sim * sim, SimClock * clock, Input input, double real_dt)
+{
+	if (clock->dt <= 0) {
+		step(sim, input, real_dt);
+		return 1;
+	}
+	// Keys that arrive between steps wait for the next one rather
+	// than getting dropped
+	for (int i = 0; i < input.key_count; i++) {
+		input_push(&clock->pending, input.keys[i]);
+	}
+	clock->accumulator += real_dt;
+	int steps = 0;
+	while (clock->accumulator >= clock->dt && steps < clock->max_steps) {
+		step(sim, clock->pending, clock->dt);
+		clock->pending.key_count = 0;
+		clock->accumulator -= clock->dt;
+		steps++;
+	}
+	if (clock->accumulator >= clock->dt) {
+		clock->accumulator = 0;
+	}
+	return steps;
+}
+
+static void hash_bytes(uint64_t * h, const void * data, size_t len)
+{
+	const uint8_t * p = (const uint8_t*) data;
+	for (size_t i = 0; i < len; i++) {
+		*h ^= p[i];
+		*h *= 1099511628211ull;
+	}
+}
+
+#define HASH(h, field) hash_bytes(h, &(field), sizeof(field))
+
+static void hash_entity(uint64_t * h, const Entity * e)
+{
+	HASH(h, e->pos);
+	HASH(h, e->grid_pos);
+	HASH(h, e->move_t);
+	HASH(h, e->move_div);
+	HASH(h, e->moving);
+	HASH(h, e->visible);
+}
+
+uint64_t sim_hash(const Sim * sim)
+{
+	// Field by field, so struct padding doesn't leak in
+	uint64_t h = 14695981039346656037ull;
+	HASH(&h, sim->game_state);
+	HASH(&h, sim->frame);
+	HASH(&h, sim->rng.state);
+	const Player * p = &sim->player;
+	hash_entity(&h, p);
+	HASH(&h, p->power_max);
+	HASH(&h, p->power_level);
+	HASH(&h, p->direction);
+	HASH(&h, p->queued_direction);
+	HASH(&h, p->move_from);
+	HASH(&h, p->death_timer);
+	HASH(&h, p->flash_timer);
+	HASH(&h, sim->level.top_left);
+	HASH(&h, sim->level.grid);
+	HASH(&h, sim->level.crystal_pos);
+	const Ghosts * gs = &sim->ghosts;
+	HASH(&h, gs->count);
+	HASH(&h, gs->live);
+	for (int i = 0; i < gs->count; i++) {
+		HASH(&h, gs->pos_x[i]);
+		HASH(&h, gs->pos_y[i]);
+		HASH(&h, gs->grid_x[i]);
+		HASH(&h, gs->grid_y[i]);
+		HASH(&h, gs->dir_x[i]);
+		HASH(&h, gs->dir_y[i]);
+		HASH(&h, gs->move_t[i]);
+		HASH(&h, gs->move_div[i]);
+		HASH(&h, gs->moving[i]);
+		HASH(&h, gs->state[i]);
+		HASH(&h, gs->id[i]);
+		HASH(&h, gs->power_type[i]);
+		HASH(&h, gs->death_timer[i]);
+		HASH(&h, gs->flash_timer[i]);
+		HASH(&h, gs->visible[i]);
+	}
+	return h;
+}
+
+void sim_snapshot(const Sim * sim, Sim * out)
+{
+	memcpy(out, sim, sizeof(Sim));
+}
+
+void sim_restore(Sim * sim, const Sim * snapshot)
+{
+	NextHopTable * hops = sim->hops;
+	Recorder * recorder = sim->recorder;
+	const LevelPack * pack = sim->pack;
+	SoundQueue * sounds = sim->sounds;
+	// By layout rather than generation: two branches of one game reach
+	// the same generation with different mazes
+	bool same_level = !memcmp(
+		sim->level.open_rows, snapshot->level.open_rows, sizeof(sim->level.open_rows));
+	memcpy(sim, snapshot, sizeof(Sim));
+	sim->hops = hops;
+	sim->recorder = recorder;
+	sim->pack = pack;
+	sim->sounds = sounds;
+	if (hops && !same_level) {
+		build_next_hop_table(hops, sim->level.grid, Level::play_w, Level::play_h);
+	}
+}
+
+void make_snapshot_pool(SnapshotPool * pool, int capacity)
+{
+	pool->capacity = capacity;
+	pool->count = 0;
+	pool->slots = (Sim*) malloc(sizeof(Sim) * capacity);
+}
+
+void destroy_snapshot_pool(SnapshotPool * pool)
+{
+	free(pool->slots);
+	pool->slots = NULL;
+	pool->capacity = 0;
+	pool->count = 0;
+}
+
+int snapshot_push(SnapshotPool * pool, const Sim * sim)
+{
+	if (pool->count == pool->capacity) return -1;
+	sim_snapshot(sim, pool->slots + pool->count);
+	return pool->count++;
+}
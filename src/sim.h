@@ -0,0 +1,356 @@
+#ifndef NES_SIM_H
+#define NES_SIM_H
+
+// Headless simulation core. Nothing in here knows about SDL, the
+// renderer or the mixer -- main.cc translates keys into Input and
+// plays whatever sounds come out the sim's SoundQueue.
+
+#include <stdint.h>
+#include <utility.h>
+
+#include "bitboard.h"
+#include "nexthop.h"
+
+// Per-game xorshift generator, so independent games never share
+// (or race on) the C library's rand() state.
+struct Rng {
+	uint32_t state;
+};
+
+inline void rng_seed(Rng * rng, uint32_t seed)
+{
+	// xorshift gets stuck at zero
+	rng->state = seed ? seed : 0x9E3779B9;
+}
+
+inline uint32_t rng_next(Rng * rng)
+{
+	uint32_t x = rng->state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	rng->state = x;
+	return x;
+}
+
+// Uniform-ish integer in [0, n)
+inline int rng_range(Rng * rng, int n)
+{
+	return (int) (((uint64_t) rng_next(rng) * (uint32_t) n) >> 32);
+}
+
+struct Texture {
+	Vector2i pos;
+	Vector2i dim;
+	Vector2f scale;
+};
+
+enum EntityType {
+	ENTITY,
+	PLAYER,
+	GHOST,
+};
+
+struct Entity {
+	Vector2i pos;
+	Vector2i grid_pos;
+	Vector2i target_pos;
+	float move_t;
+	float move_div;
+	bool moving;
+	bool visible = true;
+	Texture  tex;
+	EntityType type;
+};
+
+#define PLAYER_DEATH_TIMER_RESET 1.0
+#define PLAYER_FLASH_TIMER_RESET 0.1
+struct Player : Entity {
+	int power_max;
+	int power_level;
+	Vector2i direction;
+	Vector2i queued_direction;
+	// Tile the current move started from. The same as grid_pos, except
+	// after a mid-tile reversal (SIM_PRE_TURN), when the player heads
+	// back to grid_pos from the tile they never reached.
+	Vector2i move_from;
+	float death_timer;
+	float flash_timer;
+};
+
+enum GhostState {
+	GHOST_ALIVE,
+	GHOST_DEAD,
+};
+
+#define GHOST_DEATH_TIMER_RESET 1.0
+#define GHOST_FLASH_TIMER_RESET 0.1
+// Ghosts never spawn closer than this (in pixels) to the player
+#define MINIMUM_GHOST_DISTANCE (16 * 5)
+
+struct Level {
+	static const int play_w = 16;
+	static const int play_h = 13;
+	bool top_left = true;
+	int grid[play_w * play_h];
+	// The same layout as one bit per open cell, a uint16_t per row.
+	// Padded to 16 rows so the whole board is four 64-bit words.
+	uint16_t open_rows[16];
+	Vector2i crystal_pos;
+	// Bumped every time generate_level runs, so state carried along
+	// with the level (like the flow field) knows when to rebuild.
+	// Caches kept outside the sim key on open_rows instead: branches
+	// restored from one snapshot reach the same generation with
+	// different mazes.
+	int generation = 0;
+};
+
+// Shortest-path directions toward a single target, shared by every
+// ghost. next[i] indexes directions[] (UP, LEFT, DOWN, RIGHT) for the
+// first step from cell i, or is FLOW_NONE if the cell is the target,
+// a wall or cut off from it.
+#define FLOW_NONE 0xFF
+struct FlowField {
+	Vector2i target;
+	int generation = -1;
+	int16_t dist[Level::play_w * Level::play_h];
+	uint8_t next[Level::play_w * Level::play_h];
+};
+
+enum GameState {
+	GAME_PLAYING,
+	GAME_LOSS,
+	GAME_WIN,
+};
+
+// Keys the simulation understands. The frontend maps its own key
+// codes onto these.
+enum Key {
+	KEY_UP,
+	KEY_LEFT,
+	KEY_DOWN,
+	KEY_RIGHT,
+	KEY_POWER_DOWN,
+	KEY_POWER_UP,
+	KEY_POWER_MAX_UP,
+	KEY_POWER_MAX_DOWN,
+};
+
+#define INPUT_MAX_KEYS 8
+struct Input {
+	int key_count;
+	Key keys[INPUT_MAX_KEYS];
+};
+
+inline void input_push(Input * input, Key key)
+{
+	if (input->key_count < INPUT_MAX_KEYS) {
+		input->keys[input->key_count++] = key;
+	}
+}
+
+enum SoundEvent {
+	SOUND_PLAYER_DEATH,
+	SOUND_GHOST_DEATH,
+	SOUND_CRYSTAL_GRAB,
+	SOUND_WON_GAME,
+	SOUND_EVENT_COUNT,
+};
+
+struct Recorder;
+struct LevelPack;
+struct SoundQueue;
+
+#define SIM_MAX_GHOSTS 64
+
+static_assert(SIM_MAX_GHOSTS <= 64, "ghost ids are bits in a uint64_t");
+
+// Every ghost in play, as parallel arrays instead of one struct per
+// ghost. The movement block is all the per-frame kernel touches, four
+// ghosts to an instruction. The arrays stay dense: removing a ghost
+// moves the last one into its hole. A ghost keeps its id for as long
+// as it lives and slot[id] says where it currently is; ids are handed
+// out lowest first, so a level's ghosts are numbered in spawn order.
+struct Ghosts {
+	int count;
+	// Movement
+	int32_t pos_x[SIM_MAX_GHOSTS];
+	int32_t pos_y[SIM_MAX_GHOSTS];
+	int32_t grid_x[SIM_MAX_GHOSTS];
+	int32_t grid_y[SIM_MAX_GHOSTS];
+	int32_t dir_x[SIM_MAX_GHOSTS];
+	int32_t dir_y[SIM_MAX_GHOSTS];
+	float move_t[SIM_MAX_GHOSTS];
+	float move_div[SIM_MAX_GHOSTS];
+	int32_t moving[SIM_MAX_GHOSTS];
+	int32_t state[SIM_MAX_GHOSTS]; // GhostState
+	// Everything else
+	int32_t id[SIM_MAX_GHOSTS];
+	int32_t power_type[SIM_MAX_GHOSTS];
+	float death_timer[SIM_MAX_GHOSTS];
+	float flash_timer[SIM_MAX_GHOSTS];
+	bool visible[SIM_MAX_GHOSTS];
+	Vector2i tex_pos[SIM_MAX_GHOSTS];
+	uint64_t live; // bit per id in use
+	int8_t slot[SIM_MAX_GHOSTS];
+};
+
+inline Vector2i ghost_grid_pos(const Ghosts * gs, int i)
+{
+	return Vector2i(gs->grid_x[i], gs->grid_y[i]);
+}
+
+// Which ghosts stand on which cell: bit id of cells[i] is set while
+// the ghost with that id has grid position i. Lets blocking and hit
+// tests look at a cell instead of scanning every ghost.
+struct Occupancy {
+	uint64_t cells[Level::play_w * Level::play_h];
+};
+
+// Rule tweaks, off by default so old recordings still play back the
+// same. Replays store them in their header.
+enum SimFlag {
+	// Turns pressed early stay queued until the player reaches a tile
+	// they fit, instead of stopping the player dead, and reversing
+	// happens mid-tile instead of after finishing the move.
+	SIM_PRE_TURN = 1 << 0,
+};
+
+// Everything about a running game lives inline in here -- no heap
+// pointers -- so a Sim can be snapshotted, restored or cloned with one
+// memcpy. The only pointers are the optional hops/recorder/pack/sounds
+// attachments, which aren't part of the game state.
+struct Sim {
+	GameState game_state;
+	// Same seed + same inputs on the same frames gives the same game,
+	// bit for bit, as long as every step uses the same dt.
+	uint32_t seed;
+	uint32_t flags; // SimFlag
+	uint32_t frame;
+	Rng rng;
+	Player player;
+	Level level;
+	FlowField flow;
+	// Optional all-pairs table, owned by the caller. When set (see
+	// sim_use_next_hops) ghosts route off it instead of the flow field.
+	NextHopTable * hops;
+	// Optional, every key the sim consumes gets written to it
+	Recorder * recorder;
+	// Optional, caller-owned. When set (see sim_use_level_pack) new
+	// levels come out of it instead of being generated.
+	const LevelPack * pack;
+	// Optional, caller-owned. Sounds the game triggers get pushed onto
+	// it for an AudioSink to pick up (see audio.h); with no queue they
+	// go nowhere.
+	SoundQueue * sounds;
+	Ghosts ghosts;
+	Occupancy occupancy;
+};
+
+inline int to_index(Vector2i pos, int w = Level::play_w)
+{
+	return pos.x + pos.y * w;
+}
+
+inline int to_index(int x, int y, int w = Level::play_w)
+{
+	return x + y * w;
+}
+
+inline bool level_open(const Level * level, Vector2i pos)
+{
+	if (pos.x < 0 || pos.x >= Level::play_w || pos.y < 0 || pos.y >= Level::play_h) {
+		return false;
+	}
+	return (level->open_rows[pos.y] >> pos.x) & 1;
+}
+
+// Fixed-timestep accumulator. Real time goes in, whole SIM_DT steps
+// come out, so the game plays out the same no matter how uneven the
+// frame times are. A dt of 0 is variable-timestep mode: one step per
+// advance with the real delta.
+#define SIM_DT (1.0f / 60.0f)
+struct SimClock {
+	float dt;
+	double accumulator;
+	// Drop time rather than fall further and further behind
+	int max_steps;
+	Input pending;
+};
+
+inline void make_sim_clock(SimClock * clock, float dt = SIM_DT, int max_steps = 8)
+{
+	clock->dt = dt;
+	clock->accumulator = 0;
+	clock->max_steps = max_steps;
+	clock->pending.key_count = 0;
+}
+
+void make_sim(Sim * sim, uint32_t seed);
+void destroy_sim(Sim * sim);
+void step(Sim * sim, Input input, float dt);
+// Steps as many times as real_dt allows, and returns how many.
+// Input is applied on the first of them.
+int sim_advance(Sim * sim, SimClock * clock, Input input, double real_dt);
+// FNV-1a over everything that affects how the game plays out, for
+// checking two runs stayed in lockstep.
+uint64_t sim_hash(const Sim * sim);
+
+// Restoring keeps sim's own hops/recorder/pack/sounds attachments,
+// so a clone never rebuilds or writes into someone else's.
+void sim_snapshot(const Sim * sim, Sim * out);
+void sim_restore(Sim * sim, const Sim * snapshot);
+
+// Preallocated block of snapshots, for rollback or branching many
+// what-ifs off one game without touching the allocator.
+struct SnapshotPool {
+	int capacity;
+	int count;
+	Sim * slots;
+};
+
+void make_snapshot_pool(SnapshotPool * pool, int capacity);
+void destroy_snapshot_pool(SnapshotPool * pool);
+// Returns the slot the snapshot went into, or -1 if the pool is full
+int snapshot_push(SnapshotPool * pool, const Sim * sim);
+inline void snapshot_clone(const SnapshotPool * pool, int slot, Sim * out)
+{
+	sim_restore(out, pool->slots + slot);
+}
+inline void snapshot_pool_clear(SnapshotPool * pool)
+{
+	pool->count = 0;
+}
+void sim_use_next_hops(Sim * sim, NextHopTable * hops);
+// Swaps the starting level for one out of the pack, so call it right
+// after make_sim (and after sim_use_next_hops, to get the pack's
+// tables). The pick comes off the sim's rng, so a recording made on a
+// pack only plays back the same on that pack. NULL goes back to
+// generating levels.
+void sim_use_level_pack(Sim * sim, const LevelPack * pack);
+
+// If hops is given, also rebuilds it for the new layout (it's left
+// invalid if the maze would blow its memory bound).
+void generate_level(Level * level, Rng * rng, NextHopTable * hops = NULL);
+
+// The maze generator under generate_level, for any size of grid (non-
+// zero = wall). Starting from start, it keeps a frontier of walls next
+// to the open area and repeatedly opens a random one that touches
+// exactly one open cell. Each step is O(1): a bitmap says whether a
+// wall is already queued, and picked walls are swap-removed. So a
+// maze costs time linear in its area, and the same rng state always
+// gives the same maze. Borders stay wall. Scratch is caller-owned:
+// frontier holds width * height ints, queued (width * height + 63) /
+// 64 words.
+void carve_maze(
+	int * grid, int width, int height, Vector2i start, Rng * rng,
+	int * frontier, uint64_t * queued);
+
+// Pieces of step(), exposed for the benchmarks
+// Returns the new ghost's id, or -1 if there's no room
+int add_ghost(Sim * sim, Vector2i pos, int power_type, float move_div);
+void generate_ghosts(Sim * sim, int power);
+void update_ghosts(Sim * sim, float dt);
+void check_collision(Sim * sim);
+
+#endif
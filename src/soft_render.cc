@@ -0,0 +1,308 @@
+#include "soft_render.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Kept static so it can't clash with another stb_image elsewhere in
+// the link
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+// Same as the clear colour in main.cc
+static const uint32_t background = soft_rgba(36, 56, 225, 255);
+
+// Pixels are loaded as R, G, B, A bytes, which makes alpha the top
+// byte of each uint32_t on the (little-endian) machines we run on.
+static const uint32_t alpha_mask = 0xFF000000u;
+
+static inline bool opaque(uint32_t texel)
+{
+	return texel & alpha_mask;
+}
+
+static inline bool opaque(uint8_t texel)
+{
+	return texel != 0;
+}
+
+uint32_t soft_rgba(int r, int g, int b, int a)
+{
+	return (uint32_t) r | (uint32_t) g << 8 | (uint32_t) b << 16 | (uint32_t) a << 24;
+}
+
+int palette_find(const SoftRender * r, uint32_t color)
+{
+	for (int i = 1; i < r->palette_count; i++) {
+		if (r->palette[i] == color) return i;
+	}
+	return 0;
+}
+
+// Closest opaque palette entry to color, by squared RGB distance
+static int palette_nearest(const SoftRender * r, uint32_t color)
+{
+	int best = 1;
+	int best_dist = -1;
+	for (int i = 1; i < r->palette_count; i++) {
+		int dist = 0;
+		for (int shift = 0; shift < 24; shift += 8) {
+			int d = (int) ((color >> shift) & 0xFF) - (int) ((r->palette[i] >> shift) & 0xFF);
+			dist += d * d;
+		}
+		if (best_dist < 0 || dist < best_dist) {
+			best = i;
+			best_dist = dist;
+		}
+	}
+	return best;
+}
+
+// Numbers the atlas colours in the order they first show up, with the
+// background colour first so an empty frame is all ones. Past 255
+// colours, the rest map to their nearest entry.
+static void build_palette(SoftRender * r)
+{
+	r->palette[0] = 0;
+	r->palette[1] = background;
+	r->palette_count = 2;
+	int quantised = 0;
+	int count = r->atlas_dim.x * r->atlas_dim.y;
+	r->atlas_index = (uint8_t*) malloc(count);
+	for (int i = 0; i < count; i++) {
+		uint32_t texel = r->atlas[i];
+		if (!opaque(texel)) {
+			r->atlas_index[i] = 0;
+			continue;
+		}
+		int index = palette_find(r, texel);
+		if (index == 0) {
+			if (r->palette_count == 256) {
+				index = palette_nearest(r, texel);
+				quantised++;
+			} else {
+				index = r->palette_count++;
+				r->palette[index] = texel;
+			}
+		}
+		r->atlas_index[i] = index;
+	}
+	if (quantised) {
+		printf("Atlas has more than 255 colours, %d texels were mapped "
+			"to their nearest palette entry in indexed frames\n", quantised);
+	}
+}
+
+bool make_soft_render(SoftRender * r, const char * atlas_path, Vector2i res)
+{
+	int w, h, channels;
+	uint8_t * data = stbi_load(atlas_path, &w, &h, &channels, 4);
+	if (!data) {
+		printf("Couldn't load atlas from %s\n", atlas_path);
+		return false;
+	}
+	r->atlas = (uint32_t*) data;
+	r->atlas_dim = Vector2i(w, h);
+	r->res = res;
+	size_t pixels = (size_t) res.x * res.y;
+	r->back  = (uint32_t*) malloc(sizeof(uint32_t) * pixels);
+	r->front = (uint32_t*) malloc(sizeof(uint32_t) * pixels);
+	r->base  = (uint32_t*) malloc(sizeof(uint32_t) * pixels);
+	r->base_stamp = -1;
+	r->base_index = (uint8_t*) malloc(pixels);
+	r->base_index_stamp = -1;
+	build_palette(r);
+	make_draw_layer(&r->walls);
+	make_draw_layer(&r->hud);
+	return true;
+}
+
+void destroy_soft_render(SoftRender * r)
+{
+	destroy_draw_layer(&r->hud);
+	destroy_draw_layer(&r->walls);
+	free(r->base_index);
+	free(r->atlas_index);
+	free(r->base);
+	free(r->front);
+	free(r->back);
+	stbi_image_free(r->atlas);
+}
+
+void soft_clear(SoftRender * r, uint32_t color)
+{
+	uint32_t * p = r->back;
+	int count = r->res.x * r->res.y;
+	for (int i = 0; i < count; i++) p[i] = color;
+}
+
+// Copies every opaque src texel over dst
+static inline void key_row(uint32_t * dst, const uint32_t * src, int count)
+{
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i alpha = _mm_set1_epi32((int) alpha_mask);
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 4 <= count; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+		__m128i d = _mm_loadu_si128((const __m128i*) (dst + i));
+		__m128i keyed = _mm_cmpeq_epi32(_mm_and_si128(s, alpha), zero);
+		d = _mm_or_si128(_mm_and_si128(keyed, d), _mm_andnot_si128(keyed, s));
+		_mm_storeu_si128((__m128i*) (dst + i), d);
+	}
+#endif
+	for (; i < count; i++) {
+		if (opaque(src[i])) dst[i] = src[i];
+	}
+}
+
+// Index 0 is the transparent entry, so a 16-wide sprite row is a
+// single compare and select
+static inline void key_row(uint8_t * dst, const uint8_t * src, int count)
+{
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= count; i += 16) {
+		__m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+		__m128i d = _mm_loadu_si128((const __m128i*) (dst + i));
+		__m128i keyed = _mm_cmpeq_epi8(s, zero);
+		d = _mm_or_si128(_mm_and_si128(keyed, d), _mm_andnot_si128(keyed, s));
+		_mm_storeu_si128((__m128i*) (dst + i), d);
+	}
+#endif
+	for (; i < count; i++) {
+		if (opaque(src[i])) dst[i] = src[i];
+	}
+}
+
+template <typename P>
+static void blit(
+	P * target, Vector2i res, const P * atlas, Vector2i atlas_dim,
+	Vector2i pos, Vector2i tex_pos, Vector2i tex_dim, Vector2f scale)
+{
+	if (tex_pos.x < 0 || tex_pos.y < 0 ||
+		tex_pos.x + tex_dim.x > atlas_dim.x ||
+		tex_pos.y + tex_dim.y > atlas_dim.y) {
+		return;
+	}
+	int w = (int) (tex_dim.x * scale.x);
+	int h = (int) (tex_dim.y * scale.y);
+	int x0 = pos.x < 0 ? 0 : pos.x;
+	int y0 = pos.y < 0 ? 0 : pos.y;
+	int x1 = pos.x + w > res.x ? res.x : pos.x + w;
+	int y1 = pos.y + h > res.y ? res.y : pos.y + h;
+	if (x0 >= x1 || y0 >= y1) return;
+
+	if (w == tex_dim.x && h == tex_dim.y) {
+		for (int y = y0; y < y1; y++) {
+			const P * src = atlas
+				+ (tex_pos.y + y - pos.y) * atlas_dim.x
+				+ tex_pos.x + x0 - pos.x;
+			key_row(target + y * res.x + x0, src, x1 - x0);
+		}
+		return;
+	}
+	// Stretched: nearest texel. Only the HUD bar does this, so it can
+	// stay scalar.
+	for (int y = y0; y < y1; y++) {
+		const P * src = atlas
+			+ (tex_pos.y + (y - pos.y) * tex_dim.y / h) * atlas_dim.x
+			+ tex_pos.x;
+		P * dst = target + y * res.x;
+		// 16.16 fixed point texel step instead of a divide per pixel
+		uint32_t step = ((uint32_t) tex_dim.x << 16) / w;
+		uint32_t u = (uint32_t) (x0 - pos.x) * step;
+		for (int x = x0; x < x1; x++, u += step) {
+			P texel = src[u >> 16];
+			if (opaque(texel)) dst[x] = texel;
+		}
+	}
+}
+
+void soft_render(SoftRender * r, Vector2i pos, Vector2i tex_pos, Vector2i tex_dim, Vector2f scale)
+{
+	blit(r->back, r->res, r->atlas, r->atlas_dim, pos, tex_pos, tex_dim, scale);
+}
+
+void soft_swap(SoftRender * r)
+{
+	uint32_t * t = r->front;
+	r->front = r->back;
+	r->back = t;
+}
+
+template <typename P>
+static void draw_layer(P * target, Vector2i res, const P * atlas, Vector2i atlas_dim, const DrawLayer * layer)
+{
+	for (int i = 0; i < layer->cmds.len; i++) {
+		const DrawCmd * c = layer->cmds.arr + i;
+		blit(target, res, atlas, atlas_dim, c->pos, c->tex_pos, c->tex_dim, c->scale);
+	}
+}
+
+void soft_draw_layer(SoftRender * r, const DrawLayer * layer)
+{
+	draw_layer(r->back, r->res, r->atlas, r->atlas_dim, layer);
+}
+
+template <typename P>
+static void draw_entity(P * target, Vector2i res, const P * atlas, Vector2i atlas_dim, const Entity * e)
+{
+	if (!e->visible) return;
+	blit(target, res, atlas, atlas_dim, e->pos, e->tex.pos, e->tex.dim, e->tex.scale);
+}
+
+// Everything but the walls, on top of a copy of base, in the same
+// order main.cc draws them
+template <typename P>
+static void draw_sim(
+	SoftRender * r, const Sim * sim, P * target, const P * base, const P * atlas)
+{
+	Vector2i res = r->res;
+	Vector2i atlas_dim = r->atlas_dim;
+	memcpy(target, base, sizeof(P) * res.x * res.y);
+	DrawCmd crystal = crystal_cmd(&sim->level, &sim->player);
+	blit(target, res, atlas, atlas_dim, crystal.pos, crystal.tex_pos, crystal.tex_dim, crystal.scale);
+	draw_entity(target, res, atlas, atlas_dim, &sim->player);
+	for (int i = 0; i < sim->ghosts.count; i++) {
+		DrawCmd ghost;
+		if (ghost_cmd(&sim->ghosts, i, &ghost)) {
+			blit(target, res, atlas, atlas_dim, ghost.pos, ghost.tex_pos, ghost.tex_dim, ghost.scale);
+		}
+	}
+	bake_hud_layer(&r->hud, &sim->player, res);
+	draw_layer(target, res, atlas, atlas_dim, &r->hud);
+}
+
+const uint32_t * soft_render_sim(SoftRender * r, const Sim * sim)
+{
+	// The walls only move on a new level, so they live in base along
+	// with the clear and every frame starts as one copy of it
+	bake_wall_layer(&r->walls, &sim->level);
+	if (r->base_stamp != r->walls.builds) {
+		r->base_stamp = r->walls.builds;
+		int count = r->res.x * r->res.y;
+		for (int i = 0; i < count; i++) r->base[i] = background;
+		draw_layer(r->base, r->res, r->atlas, r->atlas_dim, &r->walls);
+	}
+	draw_sim(r, sim, r->back, r->base, r->atlas);
+	soft_swap(r);
+	return r->front;
+}
+
+void soft_render_sim_indexed(SoftRender * r, const Sim * sim, uint8_t * out)
+{
+	bake_wall_layer(&r->walls, &sim->level);
+	if (r->base_index_stamp != r->walls.builds) {
+		r->base_index_stamp = r->walls.builds;
+		memset(r->base_index, palette_find(r, background), r->res.x * r->res.y);
+		draw_layer(r->base_index, r->res, r->atlas_index, r->atlas_dim, &r->walls);
+	}
+	draw_sim(r, sim, out, r->base_index, r->atlas_index);
+}
@@ -0,0 +1,69 @@
+#ifndef NES_SOFT_RENDER_H
+#define NES_SOFT_RENDER_H
+
+// Software renderer with the same clear/render/swap surface as the
+// OpenGL Render library, drawing into RGBA framebuffers in memory. No
+// window or GPU involved, so it runs anywhere the sim does -- mostly
+// for turning headless games into pixel observations.
+//
+// Sprites come from atlas.png and are alpha keyed: a texel with zero
+// alpha is skipped, anything else is copied as-is. That's all the art
+// needs, and it keeps the blit a compare and a select per pixel.
+
+#include <stdint.h>
+#include <utility.h>
+
+#include "layer.h"
+#include "sim.h"
+
+// Pixels are R, G, B, A bytes in memory order. The baked layers are
+// keyed on what they show (the wall layout, the power levels), so one
+// SoftRender can draw any number of games, just faster if consecutive
+// frames share a maze.
+struct SoftRender {
+	Vector2i res;
+	uint32_t * back;  // being drawn into
+	uint32_t * front; // last finished frame
+	// Clear colour with the baked wall layer on top, so a frame can
+	// start from a memcpy instead of re-blitting every wall
+	uint32_t * base;
+	int base_stamp; // walls.builds it was drawn from
+	Vector2i atlas_dim;
+	uint32_t * atlas;
+	// Indexed-colour copies of the atlas and base. Entry 0 of the
+	// palette is transparent, the rest are the atlas colours.
+	uint8_t * atlas_index;
+	uint8_t * base_index;
+	int base_index_stamp;
+	int palette_count;
+	uint32_t palette[256];
+	DrawLayer walls;
+	DrawLayer hud;
+};
+
+bool make_soft_render(SoftRender * r, const char * atlas_path, Vector2i res);
+void destroy_soft_render(SoftRender * r);
+
+uint32_t soft_rgba(int r, int g, int b, int a);
+void soft_clear(SoftRender * r, uint32_t color);
+// Same arguments as Render::render. Scale stretches the source rect;
+// anything hanging off the edge of the framebuffer is clipped.
+void soft_render(SoftRender * r, Vector2i pos, Vector2i tex_pos, Vector2i tex_dim, Vector2f scale);
+void soft_draw_layer(SoftRender * r, const DrawLayer * layer);
+// Finishes the frame: it becomes r->front and drawing moves on to the
+// other buffer
+void soft_swap(SoftRender * r);
+
+// Draws a whole frame of sim the way the game does, ending with a
+// swap. Returns the finished frame (r->front).
+const uint32_t * soft_render_sim(SoftRender * r, const Sim * sim);
+
+// Same frame as soft_render_sim, but as one palette index per pixel
+// (r->palette) written straight into out, which must hold res.x *
+// res.y bytes. A quarter of the size of the RGBA frame, and it doesn't
+// touch the front/back buffers.
+void soft_render_sim_indexed(SoftRender * r, const Sim * sim, uint8_t * out);
+// Palette index of color, or 0 if the atlas doesn't use it
+int palette_find(const SoftRender * r, uint32_t color);
+
+#endif
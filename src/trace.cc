@@ -0,0 +1,126 @@
+#include "trace.h"
+
+#ifdef NES_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+// Every ring ever handed out, so trace_dump can find them. Rings are
+// never freed: a thread that exits leaves its last events behind,
+// which is what you want when it was the one that hitched.
+#define TRACE_MAX_THREADS 256
+
+static std::mutex rings_lock;
+static TraceRing * rings[TRACE_MAX_THREADS];
+static int ring_count;
+
+thread_local TraceRing * trace_local_ring;
+
+int64_t trace_now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TraceRing * trace_new_ring()
+{
+	TraceRing * ring = (TraceRing*) calloc(1, sizeof(TraceRing));
+	std::lock_guard<std::mutex> guard(rings_lock);
+	ring->thread = ring_count;
+	if (ring_count < TRACE_MAX_THREADS) rings[ring_count++] = ring;
+	trace_local_ring = ring;
+	return ring;
+}
+
+static bool write_rings(const char * path, TraceRing * const * rings, int ring_count)
+{
+	FILE * f = fopen(path, "w");
+	if (!f) return false;
+	fprintf(f, "{\"traceEvents\":[\n");
+	bool first = true;
+	for (int r = 0; r < ring_count; r++) {
+		const TraceRing * ring = rings[r];
+		uint32_t count = ring->head < TRACE_RING_SIZE ? ring->head : TRACE_RING_SIZE;
+		for (uint32_t i = ring->head - count; i != ring->head; i++) {
+			const TraceEvent * e = ring->events + (i & (TRACE_RING_SIZE - 1));
+			fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,"
+				"\"ts\":%.3f,\"dur\":%.3f",
+				first ? "" : ",\n", e->name, ring->thread,
+				e->start / 1000.0, e->duration / 1000.0);
+			if (e->arg != -1) fprintf(f, ",\"args\":{\"i\":%d}", e->arg);
+			fprintf(f, "}");
+			first = false;
+		}
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	return true;
+}
+
+bool trace_dump(const char * path)
+{
+	std::lock_guard<std::mutex> guard(rings_lock);
+	return write_rings(path, rings, ring_count);
+}
+
+// Background dumps write from a copy of the rings, so the threads
+// that own them can carry on pushing. One dump at a time.
+static std::thread writer;
+static std::atomic<bool> writer_busy;
+static TraceRing * snapshot[TRACE_MAX_THREADS];
+static int snapshot_count;
+static char snapshot_path[1024];
+
+static void write_snapshot()
+{
+	write_rings(snapshot_path, snapshot, snapshot_count);
+	writer_busy.store(false, std::memory_order_release);
+}
+
+bool trace_dump_async(const char * path)
+{
+	if (writer_busy.load(std::memory_order_acquire)) return false;
+	if (writer.joinable()) writer.join();
+	{
+		std::lock_guard<std::mutex> guard(rings_lock);
+		for (int r = 0; r < ring_count; r++) {
+			if (!snapshot[r]) snapshot[r] = (TraceRing*) malloc(sizeof(TraceRing));
+			memcpy(snapshot[r], rings[r], sizeof(TraceRing));
+		}
+		snapshot_count = ring_count;
+	}
+	snprintf(snapshot_path, sizeof(snapshot_path), "%s", path);
+	writer_busy = true;
+	writer = std::thread(write_snapshot);
+	return true;
+}
+
+void trace_flush()
+{
+	if (writer.joinable()) writer.join();
+}
+
+#else
+
+bool trace_dump(const char * path)
+{
+	(void) path;
+	return false;
+}
+
+bool trace_dump_async(const char * path)
+{
+	(void) path;
+	return false;
+}
+
+void trace_flush()
+{
+}
+
+#endif
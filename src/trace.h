@@ -0,0 +1,82 @@
+#ifndef NES_TRACE_H
+#define NES_TRACE_H
+
+// Scoped timers for the hot paths. Build with NES_TRACE defined (make
+// TRACE=1) and every TRACE_SCOPE records its name, start and duration
+// into a ring buffer owned by the calling thread; without it the
+// macros compile to nothing. Compiled in, a scope costs two clock
+// reads and a 32-byte store, a few tens of ns. trace_dump writes
+// whatever the rings still hold as Chrome trace-event JSON
+// (chrome://tracing, Perfetto).
+//
+// The rings keep the most recent TRACE_RING_SIZE scopes per thread, so
+// dump soon after whatever you want to look at. Dump from a quiet
+// point -- rings are written without locks.
+
+#include <stdint.h>
+
+#define TRACE_RING_SIZE (1 << 14)
+
+#ifdef NES_TRACE
+
+struct TraceEvent {
+	const char * name; // must be a string literal
+	int64_t start;     // ns
+	int64_t duration;  // ns
+	int32_t arg;       // e.g. which ghost, or -1
+};
+
+struct TraceRing {
+	int thread;
+	uint32_t head; // total events ever pushed
+	TraceEvent events[TRACE_RING_SIZE];
+};
+
+extern thread_local TraceRing * trace_local_ring;
+
+int64_t trace_now();
+// Registers a ring for the calling thread
+TraceRing * trace_new_ring();
+
+inline void trace_push(const char * name, int64_t start, int32_t arg)
+{
+	TraceRing * ring = trace_local_ring;
+	if (!ring) ring = trace_new_ring();
+	TraceEvent * e = ring->events + (ring->head++ & (TRACE_RING_SIZE - 1));
+	e->name = name;
+	e->start = start;
+	e->duration = trace_now() - start;
+	e->arg = arg;
+}
+
+struct TraceScope {
+	const char * name;
+	int64_t start;
+	int32_t arg;
+	TraceScope(const char * name, int32_t arg = -1)
+		: name(name), start(trace_now()), arg(arg) {}
+	~TraceScope() { trace_push(name, start, arg); }
+};
+
+#define TRACE_CAT2(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, arg) TraceScope TRACE_CAT(trace_scope_, __LINE__)(name, arg)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARG(name, arg)
+
+#endif
+
+// Returns false if the file can't be written, or tracing is compiled out
+bool trace_dump(const char * path);
+// Copies the rings and writes them out on a background thread, so the
+// caller never waits on the file. Returns false if the last one is
+// still being written, or tracing is compiled out.
+bool trace_dump_async(const char * path);
+// Waits for a trace_dump_async to finish writing
+void trace_flush();
+
+#endif